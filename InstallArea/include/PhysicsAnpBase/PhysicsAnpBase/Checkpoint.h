@@ -0,0 +1,375 @@
+// -*- c++ -*-
+#ifndef ANP_CHECKPOINT_H
+#define ANP_CHECKPOINT_H
+
+/**********************************************************************************
+ * @Package: PhysicsAnpBase
+ * @Class  : Checkpoint
+ * @Author : Rustem Ospanov
+ *
+ * @Brief  : Save and restore event loop position, histograms and algorithm state
+ *
+ *  Checkpoint is one ROOT file:
+ *   - "position" - input file index and path, next entry and number of read events
+ *   - "state"    - Registry with CutFlow state and event counters of event loop
+ *   - "text"     - free text of event loop, e.g. recorded SkimList entries
+ *   - "hists/"   - copy of all histograms of output file with same directory tree
+ *
+ *  Save() writes temporary file and renames it: previous checkpoint stays valid
+ *  if job is killed while checkpoint is written.
+ *
+ *  RestoreHists() adds saved histograms to freshly booked (empty) histograms of
+ *  restarted job, so that filling continues from exactly the same bin contents.
+ *
+ *  Registry numbers are written with full long double precision: restored
+ *  counters are bitwise identical.
+ *
+ **********************************************************************************/
+
+// C/C++
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+// ROOT
+#include "TDirectory.h"
+#include "TFile.h"
+#include "TH1.h"
+#include "TKey.h"
+
+// Base
+#include "PhysicsAnpBase/Registry.h"
+
+namespace Anp
+{
+  struct CheckpointPos
+  {
+    CheckpointPos() :file_index(-1), entry(0), icount(0) {}
+
+    bool IsValid() const { return file_index >= 0; }
+
+    std::string  file_path;
+    long         file_index;   // Index of input file in job input list
+    long         entry;        // Next entry to read in this file
+    long         icount;       // Number of events read before this entry
+  };
+
+  class Checkpoint
+  {
+  public:
+
+    Checkpoint() {}
+    ~Checkpoint() {}
+
+    void SetPath(const std::string &path) { fPath = path; }
+
+    const std::string& GetPath() const { return fPath; }
+
+    bool Save(const CheckpointPos &pos, const Registry &state, const std::string &text, TDirectory *output) const;
+
+    bool Load(CheckpointPos &pos, Registry &state, std::string &text) const;
+
+    bool RestoreHists(TDirectory *output) const;
+
+    bool Exists() const;
+
+    void Remove() const;
+
+    static void WriteRegistry(const Registry &reg, std::ostream &os, const std::string &pad = "");
+
+    static void ReadRegistry(std::istream &is, Registry &reg);
+
+    static bool HasTrees(TDirectory *dir);
+
+  private:
+
+    static void CopyHists(TDirectory *from, TDirectory *to);
+
+    static void AddHists(TDirectory *from, TDirectory *to);
+
+  private:
+
+    std::string      fPath;
+  };
+
+  //==============================================================================
+  // Inlined functions
+  //==============================================================================
+  inline bool Checkpoint::Save(const CheckpointPos &pos, const Registry &state, const std::string &text, TDirectory *output) const
+  {
+    if(fPath.empty()) {
+      return false;
+    }
+
+    const std::string tmp_path = fPath + ".tmp";
+
+    TDirectory *dir  = gDirectory;
+    TFile      *file = TFile::Open(tmp_path.c_str(), "RECREATE");
+
+    if(!file || !file->IsOpen()) {
+      std::cerr << "Checkpoint::Save - can not write: " << tmp_path << std::endl;
+      delete file;
+      return false;
+    }
+
+    std::stringstream pos_str, state_str;
+
+    pos_str << pos.file_index << " " << pos.entry << " " << pos.icount << " " << pos.file_path;
+
+    WriteRegistry(state, state_str);
+
+    TNamed pos_obj  ("position", pos_str  .str().c_str());
+    TNamed state_obj("state",    state_str.str().c_str());
+    TNamed text_obj ("text",     text.c_str());
+
+    file->WriteTObject(&pos_obj);
+    file->WriteTObject(&state_obj);
+    file->WriteTObject(&text_obj);
+
+    if(output) {
+      CopyHists(output, file->mkdir("hists"));
+    }
+
+    file->Close();
+    delete file;
+
+    if(dir) {
+      dir->cd();
+    }
+
+    if(std::rename(tmp_path.c_str(), fPath.c_str()) != 0) {
+      std::cerr << "Checkpoint::Save - failed to rename: " << tmp_path << std::endl;
+      return false;
+    }
+
+    return true;
+  }
+
+  //==============================================================================
+  inline bool Checkpoint::Load(CheckpointPos &pos, Registry &state, std::string &text) const
+  {
+    if(!Exists()) {
+      return false;
+    }
+
+    TDirectory *dir  = gDirectory;
+    TFile      *file = TFile::Open(fPath.c_str(), "READ");
+
+    if(!file || !file->IsOpen()) {
+      std::cerr << "Checkpoint::Load - can not read: " << fPath << std::endl;
+      delete file;
+      return false;
+    }
+
+    TNamed *pos_obj   = dynamic_cast<TNamed *>(file->Get("position"));
+    TNamed *state_obj = dynamic_cast<TNamed *>(file->Get("state"));
+    TNamed *text_obj  = dynamic_cast<TNamed *>(file->Get("text"));
+
+    bool result = false;
+
+    if(pos_obj && state_obj) {
+      std::stringstream pos_str(pos_obj->GetTitle());
+
+      if(pos_str >> pos.file_index >> pos.entry >> pos.icount) {
+	std::getline(pos_str >> std::ws, pos.file_path);
+
+	std::stringstream state_str(state_obj->GetTitle());
+	ReadRegistry(state_str, state);
+
+	text   = text_obj ? text_obj->GetTitle() : "";
+	result = true;
+      }
+    }
+
+    if(!result) {
+      std::cerr << "Checkpoint::Load - invalid checkpoint: " << fPath << std::endl;
+    }
+
+    file->Close();
+    delete file;
+
+    if(dir) {
+      dir->cd();
+    }
+
+    return result;
+  }
+
+  //==============================================================================
+  inline bool Checkpoint::RestoreHists(TDirectory *output) const
+  {
+    if(!output || !Exists()) {
+      return false;
+    }
+
+    TDirectory *dir  = gDirectory;
+    TFile      *file = TFile::Open(fPath.c_str(), "READ");
+
+    if(!file || !file->IsOpen()) {
+      delete file;
+      return false;
+    }
+
+    TDirectory *hists = file->GetDirectory("hists");
+
+    if(hists) {
+      AddHists(hists, output);
+    }
+
+    file->Close();
+    delete file;
+
+    if(dir) {
+      dir->cd();
+    }
+
+    return hists != 0;
+  }
+
+  //==============================================================================
+  inline bool Checkpoint::Exists() const
+  {
+    return !fPath.empty() && std::ifstream(fPath.c_str());
+  }
+
+  //==============================================================================
+  inline void Checkpoint::Remove() const
+  {
+    if(!fPath.empty()) {
+      std::remove(fPath.c_str());
+    }
+  }
+
+  //==============================================================================
+  inline bool Checkpoint::HasTrees(TDirectory *dir)
+  {
+    //
+    // Output trees are not copied into checkpoint: their entries would be lost on resume
+    //
+    if(!dir) {
+      return false;
+    }
+
+    TIter next(dir->GetList());
+
+    while(TObject *obj = next()) {
+      if(obj->InheritsFrom("TTree")) {
+	return true;
+      }
+
+      if(TDirectory *sub = dynamic_cast<TDirectory *>(obj)) {
+	if(HasTrees(sub)) {
+	  return true;
+	}
+      }
+    }
+
+    return false;
+  }
+
+  //==============================================================================
+  inline void Checkpoint::CopyHists(TDirectory *from, TDirectory *to)
+  {
+    if(!from || !to) {
+      return;
+    }
+
+    TIter next(from->GetList());
+
+    while(TObject *obj = next()) {
+      if(TDirectory *sub = dynamic_cast<TDirectory *>(obj)) {
+	CopyHists(sub, to->mkdir(sub->GetName()));
+      }
+      else if(TH1 *hist = dynamic_cast<TH1 *>(obj)) {
+	to->WriteTObject(hist);
+      }
+    }
+  }
+
+  //==============================================================================
+  inline void Checkpoint::AddHists(TDirectory *from, TDirectory *to)
+  {
+    if(!from || !to) {
+      return;
+    }
+
+    TIter next(from->GetListOfKeys());
+
+    while(TKey *key = dynamic_cast<TKey *>(next())) {
+      TObject *obj = key->ReadObj();
+
+      if(TDirectory *sub = dynamic_cast<TDirectory *>(obj)) {
+	AddHists(sub, to->GetDirectory(sub->GetName()));
+	continue;
+      }
+
+      TH1 *saved = dynamic_cast<TH1 *>(obj);
+      TH1 *live  = dynamic_cast<TH1 *>(to->Get(key->GetName()));
+
+      if(saved && live) {
+	live->Add(saved);
+      }
+      else if(saved) {
+	std::cerr << "Checkpoint::AddHists - no booked histogram for: " << key->GetName() << std::endl;
+      }
+
+      delete obj;
+    }
+  }
+
+  //==============================================================================
+  inline void Checkpoint::WriteRegistry(const Registry &reg, std::ostream &os, const std::string &pad)
+  {
+    for(const Registry::StrData &d: reg.GetStr()) {
+      os << pad << "S " << d.GetKey() << " " << d.GetData() << std::endl;
+    }
+
+    for(const Registry::DblData &d: reg.GetDbl()) {
+      char buf[64];
+      std::snprintf(buf, sizeof(buf), "%.21Lg", d.GetData());
+
+      os << pad << "D " << d.GetKey() << " " << buf << std::endl;
+    }
+
+    for(const Registry::RegData &d: reg.GetReg()) {
+      os << pad << "R " << d.GetKey() << std::endl;
+      WriteRegistry(d.GetData(), os, pad + "  ");
+      os << pad << "E" << std::endl;
+    }
+  }
+
+  //==============================================================================
+  inline void Checkpoint::ReadRegistry(std::istream &is, Registry &reg)
+  {
+    std::string line;
+
+    while(std::getline(is, line)) {
+      std::stringstream str(line);
+      std::string type, key, value;
+
+      if(!(str >> type) || type == "E") {
+	break;
+      }
+
+      str >> key;
+      std::getline(str >> std::ws, value);
+
+      if(type == "S") {
+	reg.Set(key, value);
+      }
+      else if(type == "D") {
+	reg.Set(key, std::strtold(value.c_str(), 0));
+      }
+      else if(type == "R") {
+	Registry sub;
+	ReadRegistry(is, sub);
+	reg.Set(key, sub);
+      }
+    }
+  }
+}
+
+#endif
@@ -22,6 +22,9 @@
 #include "PhysicsAnpData/Ptr.h"
 #include "PhysicsAnpData/VarEntry.h"
 
+// Base
+#include "PhysicsAnpBase/Registry.h"
+
 namespace Anp
 {
   typedef std::set<unsigned> SampleSet;
@@ -50,6 +53,9 @@ namespace Anp
 
     void AddPlotVar(const Ptr<VarEntry> &ptr, const std::string &key, const std::string &hist);
 
+    void SaveState(Registry &state) const;
+    void LoadState(const Registry &state);
+
   private:
 
     struct Count 
@@ -89,6 +95,23 @@ namespace Anp
       fHist->Fill(fVarPtr->GetData(), weight);
     }
   }
+
+  //
+  // Checkpoint of event counts: histogram is saved with output file
+  //
+  inline void Anp::CutPoll::SaveState(Registry &state) const
+  {
+    state.Set("SumN",  fCount.sumn);
+    state.Set("SumW",  fCount.sumw);
+    state.Set("SumW2", fCount.sumw2);
+  }
+
+  inline void Anp::CutPoll::LoadState(const Registry &state)
+  {
+    state.Get("SumN",  fCount.sumn);
+    state.Get("SumW",  fCount.sumw);
+    state.Get("SumW2", fCount.sumw2);
+  }
 }
 
 #endif
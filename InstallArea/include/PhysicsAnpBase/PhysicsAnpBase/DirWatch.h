@@ -0,0 +1,285 @@
+// -*- c++ -*-
+#ifndef ANP_DIRWATCH_H
+#define ANP_DIRWATCH_H
+
+/**********************************************************************************
+ * @Package: PhysicsAnpBase
+ * @Class  : DirWatch
+ * @Author : Rustem Ospanov
+ *
+ * @Brief  : Watch directory with inotify and return new complete input files
+ *
+ *  Open() adds inotify watch before directory is listed, so that files which
+ *  appear during listing are not lost:
+ *   - Wait() returns files already in directory on first call
+ *   - then it blocks up to timeout for IN_CLOSE_WRITE and IN_MOVED_TO events:
+ *     file is returned only after writer closed it or it was renamed into place
+ *   - IN_Q_OVERFLOW: kernel dropped events, so directory is listed again and
+ *     files not yet returned are found by listing
+ *
+ *  Ledger: processed files are appended to text file by MarkDone(), files listed
+ *  in ledger are never returned again - also after job restart.
+ *
+ **********************************************************************************/
+
+// C/C++
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <string>
+#include <vector>
+
+// POSIX
+#include <dirent.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+namespace Anp
+{
+  class DirWatch
+  {
+  public:
+
+    DirWatch();
+    ~DirWatch();
+
+    bool Open(const std::string &dir, const std::string &suffix);
+
+    void Close();
+
+    bool SetLedger(const std::string &path);
+
+    void MarkDone(const std::string &path);
+
+    bool Wait(int timeout_ms, std::vector<std::string> &paths);
+
+    bool IsOpen() const { return fFd >= 0; }
+
+    unsigned GetNDone() const { return fDone.size(); }
+
+  private:
+
+    bool Accept(const std::string &name, std::vector<std::string> &paths);
+
+    void ListDir(std::vector<std::string> &paths);
+
+  private:
+
+    DirWatch(const DirWatch &);
+    DirWatch& operator=(const DirWatch &);
+
+  private:
+
+    int                     fFd;          // inotify file descriptor
+    int                     fWd;          // inotify watch descriptor
+    bool                    fListed;      // Initial directory listing is done
+
+    std::string             fDir;
+    std::string             fSuffix;      // Accept only file names with this suffix
+    std::string             fLedger;      // Path of ledger file
+
+    std::set<std::string>   fSeen;        // Files already returned by Wait()
+    std::set<std::string>   fDone;        // Files listed in ledger
+  };
+
+  //==============================================================================
+  // Inlined functions
+  //==============================================================================
+  inline DirWatch::DirWatch()
+    :fFd    (-1),
+     fWd    (-1),
+     fListed(false)
+  {
+  }
+
+  //==============================================================================
+  inline DirWatch::~DirWatch()
+  {
+    Close();
+  }
+
+  //==============================================================================
+  inline bool DirWatch::Open(const std::string &dir, const std::string &suffix)
+  {
+    Close();
+
+    fDir    = dir;
+    fSuffix = suffix;
+
+    while(fDir.size() > 1 && fDir.at(fDir.size()-1) == '/') {
+      fDir.erase(fDir.size()-1);
+    }
+
+    fFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+    if(fFd < 0) {
+      std::cerr << "DirWatch::Open - inotify_init1 failed: " << strerror(errno) << std::endl;
+      return false;
+    }
+
+    fWd = inotify_add_watch(fFd, fDir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+
+    if(fWd < 0) {
+      std::cerr << "DirWatch::Open - can not watch " << fDir << ": " << strerror(errno) << std::endl;
+      Close();
+      return false;
+    }
+
+    fListed = false;
+    return true;
+  }
+
+  //==============================================================================
+  inline void DirWatch::Close()
+  {
+    if(fFd >= 0) {
+      close(fFd);
+    }
+
+    fFd = -1;
+    fWd = -1;
+  }
+
+  //==============================================================================
+  inline bool DirWatch::SetLedger(const std::string &path)
+  {
+    fLedger = path;
+
+    std::ifstream infile(path.c_str());
+    std::string   line;
+
+    while(std::getline(infile, line)) {
+      if(!line.empty()) {
+	fDone.insert(line);
+      }
+    }
+
+    return !fDone.empty();
+  }
+
+  //==============================================================================
+  inline void DirWatch::MarkDone(const std::string &path)
+  {
+    fDone.insert(path);
+
+    if(fLedger.empty()) {
+      return;
+    }
+
+    std::ofstream outfile(fLedger.c_str(), std::ios::app);
+    outfile << path << std::endl;
+  }
+
+  //==============================================================================
+  inline bool DirWatch::Accept(const std::string &name, std::vector<std::string> &paths)
+  {
+    if(name.empty() || name.at(0) == '.') {
+      return false;
+    }
+
+    if(name.size() < fSuffix.size() || name.compare(name.size()-fSuffix.size(), fSuffix.size(), fSuffix) != 0) {
+      return false;
+    }
+
+    const std::string path = fDir + "/" + name;
+
+    if(fDone.count(path) || !fSeen.insert(path).second) {
+      return false;
+    }
+
+    paths.push_back(path);
+    return true;
+  }
+
+  //==============================================================================
+  inline void DirWatch::ListDir(std::vector<std::string> &paths)
+  {
+    DIR *dir = opendir(fDir.c_str());
+
+    if(dir) {
+      while(dirent *entry = readdir(dir)) {
+	Accept(entry->d_name, paths);
+      }
+
+      closedir(dir);
+    }
+
+    fListed = true;
+  }
+
+  //==============================================================================
+  inline bool DirWatch::Wait(int timeout_ms, std::vector<std::string> &paths)
+  {
+    paths.clear();
+
+    if(fFd < 0) {
+      return false;
+    }
+
+    if(!fListed) {
+      //
+      // Files written before watch started
+      //
+      ListDir(paths);
+    }
+
+    if(paths.empty()) {
+      pollfd pfd;
+      pfd.fd      = fFd;
+      pfd.events  = POLLIN;
+      pfd.revents = 0;
+
+      if(poll(&pfd, 1, timeout_ms) < 0 && errno != EINTR) {
+	std::cerr << "DirWatch::Wait - poll failed: " << strerror(errno) << std::endl;
+	return false;
+      }
+    }
+
+    char buf[4096] __attribute__((aligned(__alignof__(inotify_event))));
+
+    bool overflow = false;
+
+    while(true) {
+      const ssize_t len = read(fFd, buf, sizeof(buf));
+
+      if(len <= 0) {
+	break;
+      }
+
+      for(char *ptr = buf; ptr < buf + len; ) {
+	const inotify_event *event = reinterpret_cast<const inotify_event *>(ptr);
+
+	if(event->mask & IN_Q_OVERFLOW) {
+	  overflow = true;
+	}
+	else if(event->len > 0 && !(event->mask & IN_ISDIR)) {
+	  Accept(event->name, paths);
+	}
+
+	ptr += sizeof(inotify_event) + event->len;
+      }
+    }
+
+    if(overflow) {
+      //
+      // Events were lost: files missed by inotify are still in directory
+      //
+      std::cout << "DirWatch::Wait - inotify queue overflow: list " << fDir << " again" << std::endl;
+
+      ListDir(paths);
+    }
+
+    //
+    // Files which appeared together are processed in name order
+    //
+    std::sort(paths.begin(), paths.end());
+
+    return true;
+  }
+}
+
+#endif
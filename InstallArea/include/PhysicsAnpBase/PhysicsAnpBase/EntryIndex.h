@@ -0,0 +1,355 @@
+// -*- c++ -*-
+#ifndef ANP_ENTRYINDEX_H
+#define ANP_ENTRYINDEX_H
+
+/**********************************************************************************
+ * @Package: PhysicsAnpBase
+ * @Class  : EntryIndex
+ * @Author : Rustem Ospanov
+ *
+ * @Brief  : Per-directory sidecar cache of tree entry counts and compressed sizes
+ *
+ *  Entry counts of files in one input directory are stored in sidecar file
+ *  ".anp_entry_index" under index directory (SidecarFile.h) with tab separated lines:
+ *
+ *    <file name> <file size> <file mtime> <tree name> <number of entries> <zip bytes>
+ *
+ *  GetEntries() returns cached count if file size and mtime match, otherwise
+ *  file is opened to count entries and cache is updated (empty trees are cached,
+ *  files which fail to open are not). Find() only reads cache: it also requires
+ *  compressed tree size, which is missing (-1) in lines written without it, so that
+ *  ChunkPlan opens only files without complete entry. Store() adds results of
+ *  InputScan. Save() merges new entries into sidecars under SidecarLock: write
+ *  errors are not fatal.
+ *
+ *  Files which can not be stat'ed (e.g. remote root:// paths) are always opened.
+ *
+ **********************************************************************************/
+
+// C/C++
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// POSIX
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Base
+#include "PhysicsAnpBase/EventChunk.h"
+#include "PhysicsAnpBase/ReadUtils.h"
+#include "PhysicsAnpBase/SidecarFile.h"
+
+namespace Anp
+{
+  class EntryIndex
+  {
+  public:
+
+    EntryIndex() :fDebug(false), fIndexDir(GetDefaultSidecarDir()), fNHit(0), fNMiss(0) {}
+    ~EntryIndex() {}
+
+    void SetDebug(bool flag) { fDebug = flag; }
+
+    void SetIndexDir(const std::string &dir) { fIndexDir = dir; }
+
+    long GetEntries(const std::string &fpath, const std::string &tree_name);
+
+    bool Find(const std::string &fpath, const std::string &tree_name, long &nentry, long long &zip_bytes);
+
+    void Store(const std::string &fpath, const std::string &tree_name, long nentry, long long zip_bytes);
+
+    void Save();
+
+    void Print(std::ostream &os = std::cout) const;
+
+    static const std::string& GetSidecarName();
+
+  private:
+
+    struct Entry
+    {
+      Entry() :fsize(0), mtime(0), nentry(0), zip_bytes(-1) {}
+
+      std::string fname;
+      std::string tree_name;
+      long long   fsize;
+      long long   mtime;
+      long        nentry;
+      long long   zip_bytes;  // Compressed tree size: -1 if unknown
+    };
+
+    typedef std::map<std::string, Entry> EntryMap;   // key: file name + tree name
+
+    struct Dir
+    {
+      EntryMap    entries;  // Entries read from sidecar and new entries
+      EntryMap    updates;  // New entries not yet saved
+    };
+
+    typedef std::map<std::string, Dir> DirMap;       // key: sidecar path
+
+  private:
+
+    Dir* GetDir(const std::string &fpath, const std::string &tree_name, struct stat &st);
+
+    static void ReadSidecar(const std::string &spath, EntryMap &entries);
+
+    static std::string GetKey(const std::string &fname, const std::string &tree_name) { return fname + "\t" + tree_name; }
+
+  private:
+
+    bool        fDebug;
+    std::string fIndexDir;  // Directory for sidecars: empty - sidecars are not used
+    long        fNHit;      // Number of counts read from sidecar
+    long        fNMiss;     // Number of counts read from input file
+    DirMap      fDirs;      // Loaded sidecars
+  };
+
+  //==============================================================================
+  // Inlined functions
+  //==============================================================================
+  inline const std::string& EntryIndex::GetSidecarName()
+  {
+    static const std::string name(".anp_entry_index");
+    return name;
+  }
+
+  //==============================================================================
+  inline EntryIndex::Dir* EntryIndex::GetDir(const std::string &fpath, const std::string &tree_name, struct stat &st)
+  {
+    //
+    // Sidecar of file directory: null if sidecars are not used for this file
+    //
+    const std::string spath = GetSidecarPath(fIndexDir, fpath, GetSidecarName());
+
+    if(spath.empty() || stat(fpath.c_str(), &st) != 0 || !IsSidecarField(SplitPath(fpath).second) || !IsSidecarField(tree_name)) {
+      return 0;
+    }
+
+    DirMap::iterator dit = fDirs.find(spath);
+
+    if(dit == fDirs.end()) {
+      dit = fDirs.insert(DirMap::value_type(spath, Dir())).first;
+      ReadSidecar(spath, dit->second.entries);
+    }
+
+    return &(dit->second);
+  }
+
+  //==============================================================================
+  inline long EntryIndex::GetEntries(const std::string &fpath, const std::string &tree_name)
+  {
+    struct stat st;
+
+    Dir *dir = GetDir(fpath, tree_name, st);
+
+    if(!dir) {
+      ++fNMiss;
+      return CountTreeEntries(fpath, tree_name);
+    }
+
+    const std::string fname = SplitPath(fpath).second;
+    const std::string key   = GetKey(fname, tree_name);
+
+    EntryMap::iterator eit = dir->entries.find(key);
+
+    if(eit != dir->entries.end() && eit->second.fsize == st.st_size && eit->second.mtime == st.st_mtime) {
+      ++fNHit;
+      return eit->second.nentry;
+    }
+
+    //
+    // Missing or stale entry: count entries and update sidecar
+    //
+    ++fNMiss;
+
+    Entry entry;
+    entry.fname     = fname;
+    entry.tree_name = tree_name;
+    entry.fsize     = st.st_size;
+    entry.mtime     = st.st_mtime;
+
+    if(ReadTreeEntries(fpath, tree_name, entry.nentry, &entry.zip_bytes)) {
+      dir->entries[key] = entry;
+      dir->updates[key] = entry;
+    }
+
+    if(fDebug) {
+      std::cout << "EntryIndex::GetEntries - updated " << fpath << ": " << entry.nentry << " entries" << std::endl;
+    }
+
+    return entry.nentry;
+  }
+
+  //==============================================================================
+  inline bool EntryIndex::Find(const std::string &fpath, const std::string &tree_name, long &nentry, long long &zip_bytes)
+  {
+    struct stat st;
+
+    Dir *dir = GetDir(fpath, tree_name, st);
+
+    if(dir) {
+      EntryMap::const_iterator eit = dir->entries.find(GetKey(SplitPath(fpath).second, tree_name));
+
+      if(eit != dir->entries.end() && eit->second.fsize == st.st_size && eit->second.mtime == st.st_mtime && eit->second.zip_bytes >= 0) {
+	nentry    = eit->second.nentry;
+	zip_bytes = eit->second.zip_bytes;
+
+	++fNHit;
+	return true;
+      }
+    }
+
+    ++fNMiss;
+    return false;
+  }
+
+  //==============================================================================
+  inline void EntryIndex::Store(const std::string &fpath, const std::string &tree_name, long nentry, long long zip_bytes)
+  {
+    struct stat st;
+
+    Dir *dir = GetDir(fpath, tree_name, st);
+
+    if(!dir) {
+      return;
+    }
+
+    Entry entry;
+    entry.fname     = SplitPath(fpath).second;
+    entry.tree_name = tree_name;
+    entry.fsize     = st.st_size;
+    entry.mtime     = st.st_mtime;
+    entry.nentry    = nentry;
+    entry.zip_bytes = zip_bytes;
+
+    const std::string key = GetKey(entry.fname, tree_name);
+
+    dir->entries[key] = entry;
+    dir->updates[key] = entry;
+  }
+
+  //==============================================================================
+  inline void EntryIndex::ReadSidecar(const std::string &spath, EntryMap &entries)
+  {
+    std::ifstream            infile(spath.c_str());
+    std::string              line;
+    std::vector<std::string> fields;
+
+    while(std::getline(infile, line)) {
+      if(line.empty() || line.at(0) == '#') {
+	continue;
+      }
+
+      SplitSidecarLine(line, fields);
+
+      Entry entry;
+
+      //
+      // Lines without compressed size (5 fields) are still valid for entry counts
+      //
+      if((fields.size() == 5 || fields.size() == 6) &&
+	 ReadSidecarField(fields.at(1), entry.fsize) &&
+	 ReadSidecarField(fields.at(2), entry.mtime) &&
+	 ReadSidecarField(fields.at(4), entry.nentry)) {
+	entry.fname     = fields.at(0);
+	entry.tree_name = fields.at(3);
+
+	if(fields.size() != 6 || !ReadSidecarField(fields.at(5), entry.zip_bytes)) {
+	  entry.zip_bytes = -1;
+	}
+
+	entries[GetKey(entry.fname, entry.tree_name)] = entry;
+      }
+    }
+  }
+
+  //==============================================================================
+  inline void EntryIndex::Save()
+  {
+    for(DirMap::value_type &d: fDirs) {
+      if(d.second.updates.empty()) {
+	continue;
+      }
+
+      const std::string &spath = d.first;
+
+      if(!MakeSidecarDir(spath)) {
+	if(fDebug) {
+	  std::cout << "EntryIndex::Save - can not create directory for: " << spath << std::endl;
+	}
+	continue;
+      }
+
+      //
+      // Re-read sidecar under lock and merge new entries: entries written by
+      // concurrent jobs since sidecar was loaded are kept
+      //
+      SidecarLock lock(spath);
+
+      if(!lock.IsLocked()) {
+	if(fDebug) {
+	  std::cout << "EntryIndex::Save - can not lock: " << spath << std::endl;
+	}
+	continue;
+      }
+
+      EntryMap entries;
+      ReadSidecar(spath, entries);
+
+      for(const EntryMap::value_type &e: d.second.updates) {
+	entries[e.first] = e.second;
+      }
+
+      std::stringstream tstr;
+      tstr << spath << ".tmp." << getpid();
+
+      const std::string tpath = tstr.str();
+
+      std::ofstream outfile(tpath.c_str());
+
+      if(!outfile) {
+	if(fDebug) {
+	  std::cout << "EntryIndex::Save - can not write: " << tpath << std::endl;
+	}
+	continue;
+      }
+
+      outfile << "# file\tsize\tmtime\ttree\tentries\tzip_bytes" << std::endl;
+
+      for(const EntryMap::value_type &e: entries) {
+	const Entry &entry = e.second;
+
+	outfile << entry.fname << "\t" << entry.fsize << "\t" << entry.mtime << "\t"
+		<< entry.tree_name << "\t" << entry.nentry << "\t" << entry.zip_bytes << std::endl;
+      }
+
+      outfile.close();
+
+      //
+      // Rename is atomic: readers never see partial sidecar
+      //
+      if(!outfile || std::rename(tpath.c_str(), spath.c_str()) != 0) {
+	std::remove(tpath.c_str());
+	continue;
+      }
+
+      d.second.entries = entries;
+      d.second.updates.clear();
+    }
+  }
+
+  //==============================================================================
+  inline void EntryIndex::Print(std::ostream &os) const
+  {
+    os << "EntryIndex::Print - " << fNHit << " count(s) read from sidecar, "
+       << fNMiss << " count(s) read from input files" << std::endl;
+  }
+}
+
+#endif
@@ -0,0 +1,386 @@
+// -*- c++ -*-
+#ifndef ANP_EVENTCHUNK_H
+#define ANP_EVENTCHUNK_H
+
+/**********************************************************************************
+ * @Package: PhysicsAnpBase
+ * @Class  : EventChunk
+ * @Author : Rustem Ospanov
+ *
+ * @Brief  : Range of entries [first, last) of one input tree
+ *
+ *  Event chunks are units of work for parallel event loops:
+ *   - input files are split into chunks of at most "chunk_size" entries
+ *   - chunks are ordered by file index and then by first entry
+ *
+ **********************************************************************************/
+
+// C/C++
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// ROOT
+#include "TFile.h"
+#include "TTree.h"
+
+namespace Anp
+{
+  struct EventChunk
+  {
+    EventChunk() :file_index(0), first_entry(0), last_entry(0) {}
+
+    long GetNEntry() const { return last_entry - first_entry; }
+
+    void Print(std::ostream &os = std::cout) const;
+
+    std::string  file_path;
+    std::string  tree_name;
+
+    unsigned     file_index;
+    long         first_entry;
+    long         last_entry;
+  };
+
+  typedef std::vector<EventChunk> ChunkVec;
+
+  //==============================================================================
+  // Split input files into chunks: at most max_event entries are used in total
+  //
+  ChunkVec MakeEventChunks(const std::vector<std::string> &paths,
+			   const std::vector<long>        &counts,
+			   const std::string              &tree_name,
+			   long                            chunk_size,
+			   long                            max_event = 0);
+
+  //==============================================================================
+  // Split entry ranges into chunks: at most max_event entries are used in total
+  //
+  ChunkVec SplitEventChunks(const ChunkVec &ranges,
+			    long            chunk_size,
+			    long            max_event = 0);
+
+  //==============================================================================
+  // Split entry ranges into chunks of about chunk_bytes compressed bytes:
+  //  bytes_per_entry is indexed by EventChunk::file_index
+  //
+  ChunkVec SplitEventChunksByBytes(const ChunkVec            &ranges,
+				   const std::vector<double> &bytes_per_entry,
+				   double                     chunk_bytes);
+
+  //==============================================================================
+  // Intersect two sorted lists of non-overlapping entry ranges of same tree
+  //
+  ChunkVec IntersectEventChunks(const ChunkVec &lhs, const ChunkVec &rhs);
+
+  //==============================================================================
+  // Select fraction [frac_min, frac_max) of entries in ordered ranges:
+  //  - contiguous - one slice of all entries of all ranges
+  //  - stratified - same slice of every range: rounding remainders are carried
+  //                 from range to range, so that complementary fractions select
+  //                 disjoint entries and all ranges together give fraction of total
+  //  - max_event > 0: fraction of first max_event entries (contiguous) or of
+  //                 max_event entries taken evenly from all ranges (stratified)
+  //
+  ChunkVec SelectFractionChunks(const ChunkVec &ranges,
+				double          frac_min,
+				double          frac_max,
+				bool            stratified,
+				long            max_event = 0);
+
+  //==============================================================================
+  // Open file and return number of entries in tree: 0 for missing file or tree
+  //
+  long CountTreeEntries(const std::string &fpath, const std::string &tree_name);
+
+  //==============================================================================
+  // Same as CountTreeEntries(): returns false for missing file or tree, so that
+  // empty trees can be told apart from failures. Compressed tree size is also
+  // returned if zip_bytes is not null
+  //
+  bool ReadTreeEntries(const std::string &fpath, const std::string &tree_name, long &nentry, long long *zip_bytes = 0);
+
+  //==============================================================================
+  // Inlined functions
+  //==============================================================================
+  inline void EventChunk::Print(std::ostream &os) const
+  {
+    os << "EventChunk - file #" << file_index << " entries [" << first_entry << ", " << last_entry << "): "
+       << file_path << std::endl;
+  }
+
+  //==============================================================================
+  inline ChunkVec MakeEventChunks(const std::vector<std::string> &paths,
+				  const std::vector<long>        &counts,
+				  const std::string              &tree_name,
+				  const long                      chunk_size,
+				  const long                      max_event)
+  {
+    ChunkVec chunks;
+
+    if(paths.size() != counts.size()) {
+      std::cerr << "MakeEventChunks - mismatched paths and counts: " << paths.size() << "!=" << counts.size() << std::endl;
+      return chunks;
+    }
+
+    long nused = 0;
+
+    for(unsigned i = 0; i < paths.size(); ++i) {
+      long nentry = counts.at(i);
+
+      if(max_event > 0) {
+	nentry = std::min<long>(nentry, max_event - nused);
+      }
+
+      for(long first = 0; first < nentry; ) {
+	EventChunk chunk;
+	chunk.file_path   = paths.at(i);
+	chunk.tree_name   = tree_name;
+	chunk.file_index  = i;
+	chunk.first_entry = first;
+	chunk.last_entry  = nentry;
+
+	if(chunk_size > 0) {
+	  chunk.last_entry = std::min<long>(first + chunk_size, nentry);
+	}
+
+	first = chunk.last_entry;
+	chunks.push_back(chunk);
+      }
+
+      nused += std::max<long>(nentry, 0);
+
+      if(max_event > 0 && nused >= max_event) {
+	break;
+      }
+    }
+
+    return chunks;
+  }
+
+  //==============================================================================
+  inline ChunkVec SplitEventChunks(const ChunkVec &ranges,
+				   const long      chunk_size,
+				   const long      max_event)
+  {
+    ChunkVec chunks;
+    long     nused = 0;
+
+    for(const EventChunk &range: ranges) {
+      long last = range.last_entry;
+
+      if(max_event > 0) {
+	last = std::min<long>(last, range.first_entry + max_event - nused);
+      }
+
+      for(long first = range.first_entry; first < last; ) {
+	EventChunk chunk(range);
+	chunk.first_entry = first;
+	chunk.last_entry  = last;
+
+	if(chunk_size > 0) {
+	  chunk.last_entry = std::min<long>(first + chunk_size, last);
+	}
+
+	first = chunk.last_entry;
+	chunks.push_back(chunk);
+      }
+
+      nused += std::max<long>(last - range.first_entry, 0);
+
+      if(max_event > 0 && nused >= max_event) {
+	break;
+      }
+    }
+
+    return chunks;
+  }
+
+  //==============================================================================
+  inline ChunkVec SplitEventChunksByBytes(const ChunkVec            &ranges,
+					  const std::vector<double> &bytes_per_entry,
+					  const double               chunk_bytes)
+  {
+    ChunkVec chunks;
+
+    for(const EventChunk &range: ranges) {
+      //
+      // Files of unknown size are split into single chunk per range
+      //
+      long chunk_size = 0;
+
+      if(range.file_index < bytes_per_entry.size() && bytes_per_entry.at(range.file_index) > 0.0) {
+	chunk_size = std::max<long>(1, static_cast<long>(chunk_bytes/bytes_per_entry.at(range.file_index)));
+      }
+
+      const ChunkVec split = SplitEventChunks(ChunkVec(1, range), chunk_size);
+      chunks.insert(chunks.end(), split.begin(), split.end());
+    }
+
+    return chunks;
+  }
+
+  //==============================================================================
+  inline ChunkVec IntersectEventChunks(const ChunkVec &lhs, const ChunkVec &rhs)
+  {
+    ChunkVec chunks;
+
+    ChunkVec::const_iterator lit = lhs.begin();
+    ChunkVec::const_iterator rit = rhs.begin();
+
+    while(lit != lhs.end() && rit != rhs.end()) {
+      const long first = std::max<long>(lit->first_entry, rit->first_entry);
+      const long last  = std::min<long>(lit->last_entry,  rit->last_entry);
+
+      if(first < last) {
+	EventChunk chunk(*lit);
+	chunk.first_entry = first;
+	chunk.last_entry  = last;
+	chunks.push_back(chunk);
+      }
+
+      if(lit->last_entry < rit->last_entry) {
+	++lit;
+      }
+      else {
+	++rit;
+      }
+    }
+
+    return chunks;
+  }
+
+  //==============================================================================
+  inline ChunkVec SelectFractionChunks(const ChunkVec &ranges,
+				       const double    frac_min,
+				       const double    frac_max,
+				       const bool      stratified,
+				       const long      max_event)
+  {
+    ChunkVec chunks;
+
+    if(stratified) {
+      //
+      // Entries of range i below fraction f: floor(f*C(i+1)) - floor(f*C(i)), where
+      // C(i) is number of entries in ranges before range i
+      //
+      long ntotal = 0;
+
+      for(const EventChunk &range: ranges) {
+	ntotal += range.GetNEntry();
+      }
+
+      const long nuse = (max_event > 0 ? std::min<long>(ntotal, max_event) : ntotal);
+
+      long nbefore = 0, nused = 0;
+
+      for(const EventChunk &range: ranges) {
+	//
+	// Entries used from this range when only max_event entries are read
+	//
+	const long nafter = nbefore + range.GetNEntry();
+	const long nrange = (ntotal > 0 ? static_cast<long>(double(nuse)*nafter/ntotal) : 0) - nused;
+
+	nbefore = nafter;
+
+	const long lo = static_cast<long>(frac_min*(nused+nrange)) - static_cast<long>(frac_min*nused);
+	const long hi = static_cast<long>(frac_max*(nused+nrange)) - static_cast<long>(frac_max*nused);
+
+	nused += nrange;
+
+	EventChunk chunk(range);
+	chunk.first_entry = range.first_entry + std::min<long>(lo, nrange);
+	chunk.last_entry  = range.first_entry + std::min<long>(hi, nrange);
+
+	if(chunk.first_entry < chunk.last_entry) {
+	  chunks.push_back(chunk);
+	}
+      }
+
+      return chunks;
+    }
+
+    long ntotal = 0;
+
+    for(const EventChunk &range: ranges) {
+      ntotal += range.GetNEntry();
+    }
+
+    if(max_event > 0) {
+      ntotal = std::min<long>(ntotal, max_event);
+    }
+
+    //
+    // Map global slice [first, last) onto ranges
+    //
+    const long first = static_cast<long>(frac_min*ntotal);
+    const long last  = static_cast<long>(frac_max*ntotal);
+
+    long offset = 0;
+
+    for(const EventChunk &range: ranges) {
+      const long lo = std::max<long>(first - offset, 0);
+      const long hi = std::min<long>(last  - offset, range.GetNEntry());
+
+      if(lo < hi) {
+	EventChunk chunk(range);
+	chunk.first_entry = range.first_entry + lo;
+	chunk.last_entry  = range.first_entry + hi;
+	chunks.push_back(chunk);
+      }
+
+      offset += range.GetNEntry();
+
+      if(offset >= last) {
+	break;
+      }
+    }
+
+    return chunks;
+  }
+
+  //==============================================================================
+  inline long CountTreeEntries(const std::string &fpath, const std::string &tree_name)
+  {
+    long nentry = 0;
+    ReadTreeEntries(fpath, tree_name, nentry);
+
+    return nentry;
+  }
+
+  //==============================================================================
+  inline bool ReadTreeEntries(const std::string &fpath, const std::string &tree_name, long &nentry, long long *zip_bytes)
+  {
+    nentry = 0;
+
+    TFile *file = TFile::Open(fpath.c_str(), "READ");
+
+    if(!file || !file->IsOpen()) {
+      std::cerr << "CountTreeEntries - failed to open: " << fpath << std::endl;
+      delete file;
+      return false;
+    }
+
+    TTree *tree = dynamic_cast<TTree *>(file->Get(tree_name.c_str()));
+    const bool found = tree;
+
+    if(tree) {
+      nentry = tree->GetEntries();
+
+      if(zip_bytes) {
+	*zip_bytes = tree->GetZipBytes();
+      }
+    }
+    else {
+      std::cerr << "CountTreeEntries - missing tree \"" << tree_name << "\" in: " << fpath << std::endl;
+    }
+
+    file->Close();
+    delete file;
+
+    return found;
+  }
+}
+
+#endif
@@ -0,0 +1,299 @@
+// -*- c++ -*-
+#ifndef ANP_INPUTSCAN_H
+#define ANP_INPUTSCAN_H
+
+/**********************************************************************************
+ * @Package: PhysicsAnpBase
+ * @Class  : InputScan
+ * @Author : Rustem Ospanov
+ *
+ * @Brief  : Open all input files concurrently at job start and collect metadata
+ *
+ *  Scan() opens input files with at most NThreads concurrent threads:
+ *   - each thread takes next file from shared counter
+ *   - input tree is validated and entries and compressed bytes are counted
+ *   - results are stored in input order in InputPlan
+ *
+ *  On network file systems job start is dominated by file open latency, not by
+ *  bandwidth: concurrent opens hide this latency. Event loop then uses counts
+ *  from InputPlan and skips files without valid input tree.
+ *
+ *  PruneBranches: GetBytesPerEntry() uses compressed size of branches declared
+ *  in BranchUsage only, since pruned branches are never read.
+ *
+ **********************************************************************************/
+
+// C/C++
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// ROOT
+#include "TFile.h"
+#include "TROOT.h"
+#include "TStopwatch.h"
+#include "TTree.h"
+
+// Base
+#include "PhysicsAnpBase/BranchUsage.h"
+#include "PhysicsAnpBase/Thread.h"
+#include "PhysicsAnpBase/UtilBase.h"
+
+namespace Anp
+{
+  void* DoInputScanWork(void *scan_);
+
+  struct InputFile
+  {
+    InputFile() :valid(false), nentry(0), zip_bytes(0), use_bytes(0) {}
+
+    std::string   file_path;
+    std::string   error;
+    bool          valid;         // File is open and contains input tree
+    long          nentry;        // Number of tree entries
+    long long     zip_bytes;     // Compressed size of tree
+    long long     use_bytes;     // Compressed size of branches which are read
+  };
+
+  typedef std::vector<InputFile> InputPlan;
+
+  class InputScan
+  {
+  public:
+
+    InputScan();
+    ~InputScan() {}
+
+    void SetNThreads (unsigned nthreads)          { fNThreads = nthreads; }
+    void SetTreeName (const std::string &tree)    { fTreeName = tree;     }
+    void SetDebug    (bool flag)                  { fDebug    = flag;     }
+    void SetPrune    (bool flag)                  { fPrune    = flag;     }
+
+    bool Scan(const std::vector<std::string> &fpaths);
+
+    const InputPlan& GetPlan() const { return fPlan; }
+
+    std::vector<std::string> GetValidFiles() const;
+
+    long GetEntries(const std::string &fpath) const;
+
+    double GetBytesPerEntry(const std::string &fpath) const;
+
+    void Print(std::ostream &os = std::cout) const;
+
+  private:
+
+    friend void* DoInputScanWork(void *);
+
+    void ScanFile(InputFile &file) const;
+
+  private:
+
+    bool               fDebug;
+    bool               fPrune;        // Count only bytes of branches declared in BranchUsage
+    unsigned           fNThreads;     // Maximum number of concurrent opens
+    std::string        fTreeName;     // Name of input tree
+
+    InputPlan          fPlan;         // Scan results in input order
+    long               fNext;         // Index of next file to scan: shared by threads
+    unsigned           fNThreadUsed;  // Number of threads used by last scan
+    double             fScanTime;     // Real time of last scan
+  };
+
+  //==============================================================================
+  // Inlined functions
+  //==============================================================================
+  inline InputScan::InputScan()
+    :fDebug      (false),
+     fPrune      (false),
+     fNThreads   (8),
+     fNext       (0),
+     fNThreadUsed(0),
+     fScanTime   (0.0)
+  {
+  }
+
+  //==============================================================================
+  inline bool InputScan::Scan(const std::vector<std::string> &fpaths)
+  {
+    TStopwatch timer;
+    timer.Start();
+
+    fPlan.clear();
+    fPlan.resize(fpaths.size());
+    fNext = 0;
+
+    for(unsigned i = 0; i < fpaths.size(); ++i) {
+      fPlan.at(i).file_path = fpaths.at(i);
+    }
+
+    const unsigned nthread = std::min<unsigned>(std::max<unsigned>(fNThreads, 1), fpaths.size());
+
+    fNThreadUsed = nthread;
+
+    if(nthread < 2) {
+      DoInputScanWork(this);
+    }
+    else {
+      //
+      // ROOT must be thread aware before threads are created
+      //
+      ROOT::EnableThreadSafety();
+
+      std::vector<Thread *> threads;
+
+      for(unsigned i = 0; i < nthread; ++i) {
+	threads.push_back(new Thread(DoInputScanWork, this));
+      }
+
+      for(Thread *thread: threads) {
+	thread->Join();
+	delete thread;
+      }
+    }
+
+    timer.Stop();
+    fScanTime = timer.RealTime();
+
+    if(fDebug) {
+      Print();
+    }
+
+    return !GetValidFiles().empty();
+  }
+
+  //==============================================================================
+  inline void InputScan::ScanFile(InputFile &file) const
+  {
+    TFile *tfile = TFile::Open(file.file_path.c_str(), "READ");
+
+    if(!tfile || !tfile->IsOpen() || tfile->IsZombie()) {
+      file.error = "failed to open file";
+      delete tfile;
+      return;
+    }
+
+    TTree *tree = dynamic_cast<TTree *>(tfile->Get(fTreeName.c_str()));
+
+    if(tree) {
+      file.valid     = true;
+      file.nentry    = tree->GetEntries();
+      file.zip_bytes = tree->GetZipBytes();
+      file.use_bytes = file.zip_bytes;
+
+      const BranchUsage &usage = BranchUsage::Instance();
+
+      if(fPrune && !usage.IsEmpty() && tree->GetListOfBranches()) {
+	//
+	// Same selection as BranchUsage::PruneTree(): only declared top level branches are read
+	//
+	file.use_bytes = 0;
+
+	TObjArray *branches = tree->GetListOfBranches();
+
+	for(int i = 0; i < branches->GetEntries(); ++i) {
+	  TBranch *branch = dynamic_cast<TBranch *>(branches->At(i));
+
+	  if(branch && usage.IsDeclared(branch)) {
+	    file.use_bytes += branch->GetZipBytes("*");
+	  }
+	}
+      }
+    }
+    else {
+      file.error = "missing tree \"" + fTreeName + "\"";
+    }
+
+    tfile->Close();
+    delete tfile;
+  }
+
+  //==============================================================================
+  inline std::vector<std::string> InputScan::GetValidFiles() const
+  {
+    std::vector<std::string> fpaths;
+
+    for(const InputFile &file: fPlan) {
+      if(file.valid) {
+	fpaths.push_back(file.file_path);
+      }
+    }
+
+    return fpaths;
+  }
+
+  //==============================================================================
+  inline long InputScan::GetEntries(const std::string &fpath) const
+  {
+    for(const InputFile &file: fPlan) {
+      if(file.file_path == fpath) {
+	return file.valid ? file.nentry : 0;
+      }
+    }
+
+    return -1;
+  }
+
+  //==============================================================================
+  inline double InputScan::GetBytesPerEntry(const std::string &fpath) const
+  {
+    for(const InputFile &file: fPlan) {
+      if(file.file_path == fpath && file.valid && file.nentry > 0) {
+	return double(file.use_bytes)/double(file.nentry);
+      }
+    }
+
+    return 0.0;
+  }
+
+  //==============================================================================
+  inline void InputScan::Print(std::ostream &os) const
+  {
+    long     nentry = 0;
+    unsigned nvalid = 0;
+
+    for(const InputFile &file: fPlan) {
+      if(!file.valid) {
+	os << "InputScan::Print - " << file.error << ": " << file.file_path << std::endl;
+	continue;
+      }
+
+      nentry += file.nentry;
+      ++nvalid;
+    }
+
+    os << "InputScan::Print - " << nvalid << "/" << fPlan.size() << " valid file(s) with " << nentry << " entries"
+       << " scanned by " << fNThreadUsed << " thread(s) in "
+       << fScanTime << "s" << std::endl;
+  }
+
+  //==============================================================================
+  // Scan thread function
+  //==============================================================================
+  inline void* DoInputScanWork(void *scan_)
+  {
+    InputScan *scan = static_cast<InputScan *>(scan_);
+
+    if(!scan) {
+      return 0;
+    }
+
+    while(true) {
+      const long ifile = __sync_fetch_and_add(&scan->fNext, 1);
+
+      if(ifile >= long(scan->fPlan.size())) {
+	break;
+      }
+
+      //
+      // Each thread writes only its own element of pre-sized plan
+      //
+      scan->ScanFile(scan->fPlan.at(ifile));
+    }
+
+    return 0;
+  }
+}
+
+#endif
@@ -0,0 +1,165 @@
+// -*- c++ -*-
+#ifndef ANP_LAZYREAD_H
+#define ANP_LAZYREAD_H
+
+/**********************************************************************************
+ * @Package: PhysicsAnpBase
+ * @Class  : LazyRead
+ * @Author : Rustem Ospanov
+ *
+ * @Brief  : Two phase read of tree entry: event branches first, heavy branches later
+ *
+ *  Branches are split into two sets when tree is bound:
+ *    - event branches - flat event level branches (trigger bits, LB, counters)
+ *    - heavy branches - vector branches of object lists (hits, muons, ...)
+ *
+ *  LoadEvent() reads only event branches, so that caller can apply prefilter.
+ *  LoadHeavy() reads heavy branches of same entry only for selected events.
+ *
+ *  Baskets of heavy branches for rejected events are never decompressed.
+ *
+ **********************************************************************************/
+
+// C/C++
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// ROOT
+#include "TBranch.h"
+#include "TTree.h"
+
+namespace Anp
+{
+  class LazyRead
+  {
+  public:
+
+    LazyRead();
+    ~LazyRead() {}
+
+    void SetTree(TTree *tree);
+
+    bool AddEventBranch(const std::string &branch) { return AddBranch(branch, fEventBranches); }
+    bool AddHeavyBranch(const std::string &branch) { return AddBranch(branch, fHeavyBranches); }
+
+    bool LoadEvent(long entry);
+
+    void LoadHeavy();
+
+    void Print(std::ostream &os = std::cout) const;
+
+    bool IsValid() const { return fTree && !fEventBranches.empty(); }
+
+    long GetNEvent() const { return fNEvent; }
+    long GetNHeavy() const { return fNHeavy; }
+
+  private:
+
+    typedef std::vector<TBranch *> BranchVec;
+
+  private:
+
+    bool AddBranch(const std::string &branch, BranchVec &branches);
+
+  private:
+
+    TTree         *fTree;            // Current input tree
+    BranchVec      fEventBranches;   // Branches read by LoadEvent()
+    BranchVec      fHeavyBranches;   // Branches read by LoadHeavy()
+    long           fLocalEntry;      // Entry of current tree loaded by LoadEvent()
+
+    long           fNEvent;          // Number of entries read by LoadEvent()
+    long           fNHeavy;          // Number of entries read by LoadHeavy()
+    long long      fEventBytes;      // Uncompressed bytes read by LoadEvent()
+    long long      fHeavyBytes;      // Uncompressed bytes read by LoadHeavy()
+  };
+
+  //==============================================================================
+  // Inlined functions
+  //==============================================================================
+  inline LazyRead::LazyRead()
+    :fTree      (0),
+     fLocalEntry(-1),
+     fNEvent    (0),
+     fNHeavy    (0),
+     fEventBytes(0),
+     fHeavyBytes(0)
+  {
+  }
+
+  //==============================================================================
+  inline void LazyRead::SetTree(TTree *tree)
+  {
+    fTree       = tree;
+    fLocalEntry = -1;
+
+    fEventBranches.clear();
+    fHeavyBranches.clear();
+  }
+
+  //==============================================================================
+  inline bool LazyRead::AddBranch(const std::string &branch, BranchVec &branches)
+  {
+    TBranch *b = fTree ? fTree->GetBranch(branch.c_str()) : 0;
+
+    if(!b) {
+      return false;
+    }
+
+    if(std::find(branches.begin(), branches.end(), b) == branches.end()) {
+      branches.push_back(b);
+    }
+
+    return true;
+  }
+
+  //==============================================================================
+  inline bool LazyRead::LoadEvent(long entry)
+  {
+    if(!fTree) {
+      return false;
+    }
+
+    fLocalEntry = fTree->LoadTree(entry);
+
+    if(fLocalEntry < 0) {
+      return false;
+    }
+
+    for(TBranch *b: fEventBranches) {
+      fEventBytes += b->GetEntry(fLocalEntry);
+    }
+
+    ++fNEvent;
+    return true;
+  }
+
+  //==============================================================================
+  inline void LazyRead::LoadHeavy()
+  {
+    if(fLocalEntry < 0) {
+      return;
+    }
+
+    for(TBranch *b: fHeavyBranches) {
+      fHeavyBytes += b->GetEntry(fLocalEntry);
+    }
+
+    ++fNHeavy;
+  }
+
+  //==============================================================================
+  inline void LazyRead::Print(std::ostream &os) const
+  {
+    os << "LazyRead::Print - read " << fNEvent << " event(s): " << fEventBytes/1048576.0 << " MB of event branches" << std::endl
+       << "LazyRead::Print - read " << fNHeavy << " event(s): " << fHeavyBytes/1048576.0 << " MB of heavy branches" << std::endl;
+
+    if(fNEvent > 0) {
+      os << "LazyRead::Print - heavy branches skipped for " << fNEvent-fNHeavy << " rejected event(s)" << std::endl;
+    }
+  }
+}
+
+#endif
@@ -0,0 +1,468 @@
+// -*- c++ -*-
+#ifndef ANP_LUMIINDEX_H
+#define ANP_LUMIINDEX_H
+
+/**********************************************************************************
+ * @Package: PhysicsAnpBase
+ * @Class  : LumiIndex
+ * @Author : Rustem Ospanov
+ *
+ * @Brief  : Per-file index of (run, lumi block) to tree entry ranges
+ *
+ *  Index is built by reading only run and lumi block branches and stored in
+ *  per-directory sidecar file ".anp_lumi_index" under index directory
+ *  (SidecarFile.h) with tab separated lines:
+ *
+ *    <file name> <file size> <file mtime> <tree name> <run> <lb> <first entry> <last entry>
+ *
+ *  Sidecar lines for one file are valid only if file size and mtime match.
+ *  Save() merges new indexes into sidecars under SidecarLock.
+ *
+ *  SelectEntries() fills entry ranges [first, last) with MinLB <= LB <= MaxLB,
+ *  so that event loop can seek directly to selected entries and skip files
+ *  without selected lumi blocks. MinLB or MaxLB < 1 means no limit.
+ *  SelectEntries() returns false if index can not be built (e.g. missing
+ *  run or lumi block branch): caller should then read all entries.
+ *
+ **********************************************************************************/
+
+// C/C++
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// POSIX
+#include <sys/stat.h>
+#include <unistd.h>
+
+// ROOT
+#include "TBranch.h"
+#include "TFile.h"
+#include "TTree.h"
+
+// Base
+#include "PhysicsAnpBase/EventChunk.h"
+#include "PhysicsAnpBase/ReadUtils.h"
+#include "PhysicsAnpBase/SidecarFile.h"
+
+namespace Anp
+{
+  struct LumiRange
+  {
+    LumiRange() :run(0), lb(0), first_entry(0), last_entry(0) {}
+
+    unsigned   run;
+    unsigned   lb;
+    long       first_entry;
+    long       last_entry;
+  };
+
+  typedef std::vector<LumiRange> LumiRangeVec;
+
+  class LumiIndex
+  {
+  public:
+
+    LumiIndex();
+    ~LumiIndex() {}
+
+    void SetBranches(const std::string &run_branch, const std::string &lb_branch);
+
+    void SetDebug(bool flag) { fDebug = flag; }
+
+    void SetIndexDir(const std::string &dir) { fIndexDir = dir; }
+
+    bool SelectEntries(const std::string &fpath, const std::string &tree_name, int min_lb, int max_lb, ChunkVec &chunks);
+
+    const LumiRangeVec& GetRanges(const std::string &fpath, const std::string &tree_name);
+
+    bool GetLumiChunks(const std::string &fpath, const std::string &tree_name, ChunkVec &chunks);
+
+    void Save();
+
+    void Print(std::ostream &os = std::cout) const;
+
+    static const std::string& GetSidecarName();
+
+    static bool IsSelected(unsigned lb, int min_lb, int max_lb)
+    {
+      return (min_lb < 1 || int(lb) >= min_lb) && (max_lb < 1 || int(lb) <= max_lb);
+    }
+
+  private:
+
+    struct Entry
+    {
+      Entry() :fsize(0), mtime(0) {}
+
+      std::string     fname;
+      std::string     tree_name;
+      long long       fsize;
+      long long       mtime;
+      LumiRangeVec    ranges;
+    };
+
+    typedef std::map<std::string, Entry> EntryMap;   // key: file name + tree name
+
+    struct Dir
+    {
+      EntryMap    entries;  // Entries read from sidecar and new entries
+      EntryMap    updates;  // New entries not yet saved
+    };
+
+    typedef std::map<std::string, Dir> DirMap;       // key: sidecar path
+
+  private:
+
+    static void ReadSidecar(const std::string &spath, EntryMap &entries);
+
+    bool BuildRanges(const std::string &fpath, const std::string &tree_name, LumiRangeVec &ranges) const;
+
+    static std::string GetKey(const std::string &fname, const std::string &tree_name) { return fname + "\t" + tree_name; }
+
+  private:
+
+    bool            fDebug;
+    std::string     fRunBranch;    // Name of run number branch
+    std::string     fLBBranch;     // Name of lumi block branch
+    std::string     fIndexDir;     // Directory for sidecars: empty - indexes are kept in memory only
+
+    long            fNHit;         // Number of indexes read from sidecar
+    long            fNBuild;       // Number of indexes built from input file
+    long            fNSkipFile;    // Number of files without selected lumi blocks
+
+    DirMap          fDirs;         // Loaded sidecars
+    EntryMap        fMemory;       // Indexes for files which can not be stat'ed
+  };
+
+  //==============================================================================
+  // Inlined functions
+  //==============================================================================
+  inline LumiIndex::LumiIndex()
+    :fDebug    (false),
+     fRunBranch("Run"),
+     fLBBranch ("LumiBlock"),
+     fIndexDir (GetDefaultSidecarDir()),
+     fNHit     (0),
+     fNBuild   (0),
+     fNSkipFile(0)
+  {
+  }
+
+  //==============================================================================
+  inline const std::string& LumiIndex::GetSidecarName()
+  {
+    static const std::string name(".anp_lumi_index");
+    return name;
+  }
+
+  //==============================================================================
+  inline void LumiIndex::SetBranches(const std::string &run_branch, const std::string &lb_branch)
+  {
+    fRunBranch = run_branch;
+    fLBBranch  = lb_branch;
+  }
+
+  //==============================================================================
+  inline bool LumiIndex::SelectEntries(const std::string &fpath, const std::string &tree_name,
+				       int min_lb, int max_lb, ChunkVec &chunks)
+  {
+    //
+    // Merge adjacent selected ranges into chunks
+    //
+    chunks.clear();
+
+    const LumiRangeVec &ranges = GetRanges(fpath, tree_name);
+
+    if(ranges.empty()) {
+      return false;
+    }
+
+    for(const LumiRange &range: ranges) {
+      if(!IsSelected(range.lb, min_lb, max_lb)) {
+	continue;
+      }
+
+      if(!chunks.empty() && chunks.back().last_entry == range.first_entry) {
+	chunks.back().last_entry = range.last_entry;
+	continue;
+      }
+
+      EventChunk chunk;
+      chunk.file_path   = fpath;
+      chunk.tree_name   = tree_name;
+      chunk.first_entry = range.first_entry;
+      chunk.last_entry  = range.last_entry;
+
+      chunks.push_back(chunk);
+    }
+
+    if(chunks.empty()) {
+      ++fNSkipFile;
+    }
+
+    return true;
+  }
+
+  //==============================================================================
+  inline bool LumiIndex::GetLumiChunks(const std::string &fpath, const std::string &tree_name, ChunkVec &chunks)
+  {
+    //
+    // One chunk per lumi block range: used to take same fraction of every lumi block
+    //
+    chunks.clear();
+
+    for(const LumiRange &range: GetRanges(fpath, tree_name)) {
+      EventChunk chunk;
+      chunk.file_path   = fpath;
+      chunk.tree_name   = tree_name;
+      chunk.first_entry = range.first_entry;
+      chunk.last_entry  = range.last_entry;
+
+      chunks.push_back(chunk);
+    }
+
+    return !chunks.empty();
+  }
+
+  //==============================================================================
+  inline const LumiRangeVec& LumiIndex::GetRanges(const std::string &fpath, const std::string &tree_name)
+  {
+    struct stat st;
+
+    const std::string spath = GetSidecarPath(fIndexDir, fpath, GetSidecarName());
+    const std::string fname = SplitPath(fpath).second;
+
+    if(spath.empty() || stat(fpath.c_str(), &st) != 0 || !IsSidecarField(fname) || !IsSidecarField(tree_name)) {
+      //
+      // No sidecar for this file (no index directory or file can not be stat'ed): build index in memory only
+      //
+      Entry &entry = fMemory[GetKey(fpath, tree_name)];
+
+      if(entry.ranges.empty()) {
+	BuildRanges(fpath, tree_name, entry.ranges);
+	++fNBuild;
+      }
+
+      return entry.ranges;
+    }
+
+    DirMap::iterator dit = fDirs.find(spath);
+
+    if(dit == fDirs.end()) {
+      dit = fDirs.insert(DirMap::value_type(spath, Dir())).first;
+      ReadSidecar(spath, dit->second.entries);
+    }
+
+    Dir &dir = dit->second;
+
+    const std::string key = GetKey(fname, tree_name);
+
+    Entry &entry = dir.entries[key];
+
+    if(entry.fsize == st.st_size && entry.mtime == st.st_mtime && !entry.ranges.empty()) {
+      ++fNHit;
+      return entry.ranges;
+    }
+
+    entry.fname     = fname;
+    entry.tree_name = tree_name;
+    entry.fsize     = st.st_size;
+    entry.mtime     = st.st_mtime;
+    entry.ranges.clear();
+
+    if(BuildRanges(fpath, tree_name, entry.ranges)) {
+      dir.updates[key] = entry;
+    }
+
+    ++fNBuild;
+    return entry.ranges;
+  }
+
+  //==============================================================================
+  inline bool LumiIndex::BuildRanges(const std::string &fpath, const std::string &tree_name, LumiRangeVec &ranges) const
+  {
+    TFile *file = TFile::Open(fpath.c_str(), "READ");
+
+    if(!file || !file->IsOpen()) {
+      std::cerr << "LumiIndex::BuildRanges - failed to open: " << fpath << std::endl;
+      delete file;
+      return false;
+    }
+
+    TTree *tree = dynamic_cast<TTree *>(file->Get(tree_name.c_str()));
+    TLeaf *lrun = tree ? tree->GetLeaf(fRunBranch.c_str()) : 0;
+    TLeaf *llb  = tree ? tree->GetLeaf(fLBBranch .c_str()) : 0;
+
+    if(!lrun || !llb) {
+      std::cerr << "LumiIndex::BuildRanges - missing tree or run/LB branches in: " << fpath << std::endl;
+      file->Close();
+      delete file;
+      return false;
+    }
+
+    //
+    // Read only run and lumi block branches: leaf handles any integer type
+    //
+    TBranch *brun = lrun->GetBranch();
+    TBranch *blb  = llb ->GetBranch();
+
+    const long nentry = tree->GetEntries();
+
+    for(long entry = 0; entry < nentry; ++entry) {
+      brun->GetEntry(entry);
+      blb ->GetEntry(entry);
+
+      const unsigned run = static_cast<unsigned>(lrun->GetValue());
+      const unsigned lb  = static_cast<unsigned>(llb ->GetValue());
+
+      if(!ranges.empty() && ranges.back().run == run && ranges.back().lb == lb) {
+	ranges.back().last_entry = entry+1;
+	continue;
+      }
+
+      LumiRange range;
+      range.run         = run;
+      range.lb          = lb;
+      range.first_entry = entry;
+      range.last_entry  = entry+1;
+
+      ranges.push_back(range);
+    }
+
+    file->Close();
+    delete file;
+
+    if(fDebug) {
+      std::cout << "LumiIndex::BuildRanges - " << ranges.size() << " range(s) for " << nentry << " entries: " << fpath << std::endl;
+    }
+
+    return !ranges.empty();
+  }
+
+  //==============================================================================
+  inline void LumiIndex::ReadSidecar(const std::string &spath, EntryMap &entries)
+  {
+    std::ifstream            infile(spath.c_str());
+    std::string              line;
+    std::vector<std::string> fields;
+
+    while(std::getline(infile, line)) {
+      if(line.empty() || line.at(0) == '#') {
+	continue;
+      }
+
+      SplitSidecarLine(line, fields);
+
+      Entry     entry;
+      LumiRange range;
+
+      if(fields.size() == 8 &&
+	 ReadSidecarField(fields.at(1), entry.fsize) &&
+	 ReadSidecarField(fields.at(2), entry.mtime) &&
+	 ReadSidecarField(fields.at(4), range.run) &&
+	 ReadSidecarField(fields.at(5), range.lb) &&
+	 ReadSidecarField(fields.at(6), range.first_entry) &&
+	 ReadSidecarField(fields.at(7), range.last_entry)) {
+
+	Entry &e = entries[GetKey(fields.at(0), fields.at(3))];
+
+	if(e.ranges.empty()) {
+	  e.fname     = fields.at(0);
+	  e.tree_name = fields.at(3);
+	  e.fsize     = entry.fsize;
+	  e.mtime     = entry.mtime;
+	}
+
+	e.ranges.push_back(range);
+      }
+    }
+  }
+
+  //==============================================================================
+  inline void LumiIndex::Save()
+  {
+    for(DirMap::value_type &d: fDirs) {
+      if(d.second.updates.empty()) {
+	continue;
+      }
+
+      const std::string &spath = d.first;
+
+      if(!MakeSidecarDir(spath)) {
+	if(fDebug) {
+	  std::cout << "LumiIndex::Save - can not create directory for: " << spath << std::endl;
+	}
+	continue;
+      }
+
+      //
+      // Re-read sidecar under lock and merge new indexes: indexes written by
+      // concurrent jobs since sidecar was loaded are kept
+      //
+      SidecarLock lock(spath);
+
+      if(!lock.IsLocked()) {
+	if(fDebug) {
+	  std::cout << "LumiIndex::Save - can not lock: " << spath << std::endl;
+	}
+	continue;
+      }
+
+      EntryMap entries;
+      ReadSidecar(spath, entries);
+
+      for(const EntryMap::value_type &e: d.second.updates) {
+	entries[e.first] = e.second;
+      }
+
+      std::stringstream tstr;
+      tstr << spath << ".tmp." << getpid();
+
+      const std::string tpath = tstr.str();
+
+      std::ofstream outfile(tpath.c_str());
+
+      if(!outfile) {
+	if(fDebug) {
+	  std::cout << "LumiIndex::Save - can not write: " << tpath << std::endl;
+	}
+	continue;
+      }
+
+      outfile << "# file\tsize\tmtime\ttree\trun\tlb\tfirst_entry\tlast_entry" << std::endl;
+
+      for(const EntryMap::value_type &e: entries) {
+	const Entry &entry = e.second;
+
+	for(const LumiRange &range: entry.ranges) {
+	  outfile << entry.fname << "\t" << entry.fsize << "\t" << entry.mtime << "\t" << entry.tree_name << "\t"
+		  << range.run << "\t" << range.lb << "\t" << range.first_entry << "\t" << range.last_entry << std::endl;
+	}
+      }
+
+      outfile.close();
+
+      if(!outfile || std::rename(tpath.c_str(), spath.c_str()) != 0) {
+	std::remove(tpath.c_str());
+	continue;
+      }
+
+      d.second.entries = entries;
+      d.second.updates.clear();
+    }
+  }
+
+  //==============================================================================
+  inline void LumiIndex::Print(std::ostream &os) const
+  {
+    os << "LumiIndex::Print - " << fNHit << " index(es) read from sidecar, " << fNBuild << " index(es) built, "
+       << fNSkipFile << " file(s) without selected lumi blocks" << std::endl;
+  }
+}
+
+#endif
@@ -0,0 +1,1085 @@
+// -*- c++ -*-
+#ifndef ANP_READLOOP_H
+#define ANP_READLOOP_H
+
+/**********************************************************************************
+ * @Package: PhysicsAnpBase
+ * @Class  : ReadLoop
+ * @Author : Rustem Ospanov
+ *
+ * @Brief  : Event loop over EventChunks with public ReadNtuple interface
+ *
+ *  ReadLoop owns one ReadNtuple and reads chunks made by ChunkPlan:
+ *
+ *  - Config()    - configure ReadNtuple without InputFiles: entry ranges, NEvent
+ *                  and EventFracMin/Max are already applied by ChunkPlan
+ *  - Init()      - initialize algorithms
+ *  - ReadChunk() - open input file if it differs from current file and read
+ *                  entries [first_entry, last_entry) with ReadNtuple::ReadEntry()
+ *  - Done()      - close last input file and finalize algorithms
+ *
+ *  Input tree opened by ReadNtuple::OpenFile() is found through gROOT list of files,
+ *  so that input I/O is tuned without changing ReadNtuple:
+ *
+ *  - PruneBranches=yes: branches not declared by algorithm configurations are
+ *    disabled (DeclareUsage()): unused Lists are not read
+ *  - CacheSize/CachePrefetch/CacheUnzip: TreeCache is attached after pruning, so that
+ *    cache learns only active branches, and Done() prints cache efficiency. These keys
+ *    alone do not select ReadLoop: exact CacheSize in bytes is applied only here
+ *  - TwoPhaseRead=yes: "Prefilter" cuts are applied before ReadNtuple::ReadEntry().
+ *    LazyRead loads only flat branches named after registered variables, entries
+ *    which fail prefilter are skipped, so that their vector branches are never read
+ *  - Skims=<names>: entries which pass "Skim<name>" cuts on same event variables
+ *    are recorded in SkimList, Done() writes it next to OutputFile (SkimList.h)
+ *  - EventCache=yes: entries which pass "EventCache" cuts are copied into EventCache
+ *    after ReadNtuple::ReadEntry(). After algorithms of job are finalized, Done()
+ *    reads cached events EventCachePasses times with separate ReadNtuple, which runs
+ *    only EventCacheAlg algorithm and writes EventCacheOutputFile (default is
+ *    OutputFile with "_replay" suffix): algorithms of job see each event once and
+ *    their output is never replayed. EventCache::GetPass() returns pass number.
+ *    Replayed events have InputInfo file path of cache segment. Cache is not kept
+ *    without EventCacheAlg and is not replayed if it ran out of EventCacheMinFreeMB
+ *    space in EventCacheSpillDir. EventCache is refused with TwoPhaseRead: clone
+ *    shares branch buffers and rejected entries are only partially read
+ *  - BranchStats=yes: BranchStats is attached to input tree after TreeCache and
+ *    detached before input file is closed. Done() writes it into OutputFile before
+ *    ReadNtuple::Done() writes output file, prints it and saves BranchStatsText
+ *  - StageDir=<path>: input files are staged into local cache by FileStage and
+ *    ReadNtuple opens local copy, next input file is copied in background. Chunks,
+ *    skims and checkpoints use original input path, InputInfo has local path
+ *  - Checkpoint=<path>: single process jobs write position of next entry, histograms
+ *    of OutputFile, prefilter, skim and cache cut counts and recorded skim entries
+ *    every CheckpointNEvent entries or CheckpointSec seconds. Resume=yes: Init()
+ *    restores them and ReadChunk() skips entries read before checkpoint. Only
+ *    histograms of algorithms are restored: checkpoints are refused with EventCache,
+ *    when OutputFile contains output trees and unless every configured algorithm
+ *    is declared to keep its state only in histograms - CheckpointSafe=yes in its
+ *    configuration or its AlgType listed in CheckpointSafeAlgs
+ *
+ *  Used by ReadProcs for each worker process and for single process jobs which
+ *  need any of the above or entry selection by ChunkPlan (IsNeeded()): MinLB/MaxLB
+ *  chunks contain only entry ranges of selected lumi blocks, EventFracMin/EventFracMax
+ *  chunks only selected fraction of entries, so that skipped entries are never read,
+ *  ScanThreads > 1 opens input files concurrently and drops invalid files.
+ *
+ **********************************************************************************/
+
+// C/C++
+#include <algorithm>
+#include <ctime>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// ROOT
+#include "TFile.h"
+#include "TLeaf.h"
+#include "TROOT.h"
+#include "TStopwatch.h"
+#include "TTree.h"
+
+// Data
+#include "PhysicsAnpData/RecoEvent.h"
+
+// Base
+#include "PhysicsAnpBase/BranchStats.h"
+#include "PhysicsAnpBase/BranchUsage.h"
+#include "PhysicsAnpBase/Checkpoint.h"
+#include "PhysicsAnpBase/CutFlow.h"
+#include "PhysicsAnpBase/EventCache.h"
+#include "PhysicsAnpBase/EventChunk.h"
+#include "PhysicsAnpBase/FileStage.h"
+#include "PhysicsAnpBase/LazyRead.h"
+#include "PhysicsAnpBase/ReadNtuple.h"
+#include "PhysicsAnpBase/Registry.h"
+#include "PhysicsAnpBase/SkimList.h"
+#include "PhysicsAnpBase/TreeCache.h"
+#include "PhysicsAnpBase/UtilBase.h"
+
+namespace Anp
+{
+  class ReadLoop
+  {
+  public:
+
+    ReadLoop();
+    ~ReadLoop() {}
+
+    static bool IsNeeded(const Registry &reg);
+
+    static void DeclareUsage(const Registry &reg);
+
+    void Config(const Registry &reg);
+
+    bool Init();
+
+    void SetInputFiles(const std::vector<std::string> &fpaths) { fInputFiles = fpaths; }
+
+    void ReadChunk(const EventChunk &chunk);
+
+    void Done();
+
+    long GetNFile()  const { return fNFile; }
+    long GetNEvent() const { return fNEvent; }
+
+  private:
+
+    bool OpenFile(const std::string &fpath, const std::string &tree_name);
+
+    void CloseFile();
+
+    std::string StageInputFile(const std::string &fpath);
+
+    void BindEventVars();
+
+    void FillEventVars();
+
+    bool PassPrefilter(long entry);
+
+    void RecordSkims(long entry);
+
+    void CacheEvent();
+
+    void ReplayEventCache();
+
+    bool LoadCheckpoint();
+
+    void SaveCheckpoint(const EventChunk &chunk, long next_entry);
+
+    void SaveCutState(Registry &state) const;
+
+    void LoadCutState(const Registry &state);
+
+    bool IsCheckpointAllowed();
+
+    TFile* GetOutputFile() const;
+
+    static void DeclareInputs(const Registry &reg, const std::string &caller);
+
+    static void FindUnsafeAlgs(const Registry &reg, const std::vector<std::string> &safe_types, std::vector<std::string> &unsafe);
+
+    std::ostream& log() const;
+
+  private:
+
+    ReadLoop(const ReadLoop &);
+    ReadLoop& operator=(const ReadLoop &);
+
+  private:
+
+    typedef std::vector<std::pair<TLeaf *, unsigned> > LeafVec;
+    typedef std::map<std::string, CutFlow>              SkimMap;
+
+  private:
+
+    ReadNtuple                 fRead;               // Event loop and algorithms
+    TreeCache                  fTreeCache;          // TTreeCache for input trees
+    BranchStats                fBranchStats;        // Per-branch I/O statistics of input trees
+    FileStage                  fFileStage;          // Local staging cache for input files
+
+    LazyRead                   fLazyRead;           // Reads prefilter branches of current tree
+    CutFlow                    fPrefilter;          // Cuts on event variables before ReadNtuple::ReadEntry()
+    SkimMap                    fSkimCuts;           // Cuts on event variables for each recorded skim
+    SkimList                   fSkimList;           // Recorded skim entries
+    RecoEvent                  fEventVars;          // Event variables for prefilter and skims
+    LeafVec                    fEventLeaves;        // Leaves of flat event branches and their variables
+    EventCache                 fEventCache;         // Compressed copy of selected events for replay passes
+    CutFlow                    fEventCacheCut;      // Cuts on event variables for events copied into cache
+    Checkpoint                 fCheckpoint;         // Periodic checkpoint of event loop
+    CheckpointPos              fResumePos;          // Position of loaded checkpoint (Resume=yes)
+
+    // Properties:
+    bool                       fDebug;              // Print debug info
+    bool                       fPruneBranches;      // Disable input branches not declared in BranchUsage
+    bool                       fTwoPhaseRead;       // Apply prefilter before entry is read by ReadNtuple
+    bool                       fCacheEvents;        // Copy selected events into EventCache
+    unsigned                   fCachePasses;        // Number of replay passes over EventCache
+    Registry                   fReplayReg;          // ReadNtuple configuration for EventCacheAlg replay
+    std::string                fOutputFile;         // Output ROOT file: skim lists are written next to it
+    long                       fCheckpointNEvent;   // Write checkpoint every N entries (0 - use only CheckpointSec)
+    unsigned                   fCheckpointSec;      // Write checkpoint every N seconds (0 - use only CheckpointNEvent)
+    bool                       fResume;             // Resume from checkpoint if it exists
+
+    // Variables:
+    std::vector<std::string>   fInputFiles;         // Input files of job: checkpoint position and prefetch use them
+    std::string                fCurrentPath;        // Path of current input file
+    std::string                fFailedPath;         // Path of last input file which failed to open
+    TFile                     *fInputFile;          // Current input file opened by ReadNtuple
+    TTree                     *fInputTree;          // Current input tree opened by ReadNtuple
+
+    long                       fNFile;              // Number of opened input files
+    long                       fNEvent;             // Number of read entries
+    long                       fNReject;            // Number of entries rejected by prefilter
+    long                       fNEntry;             // Number of entries read or rejected
+    time_t                     fCheckpointTime;     // Time of last checkpoint
+  };
+
+  //==============================================================================
+  // Inlined functions
+  //==============================================================================
+  inline ReadLoop::ReadLoop()
+    :fDebug        (false),
+     fPruneBranches(false),
+     fTwoPhaseRead (false),
+     fCacheEvents  (false),
+     fCachePasses  (1),
+     fCheckpointNEvent(0),
+     fCheckpointSec(600),
+     fResume       (false),
+     fInputFile    (0),
+     fInputTree    (0),
+     fNFile        (0),
+     fNEvent       (0),
+     fNReject      (0),
+     fNEntry       (0),
+     fCheckpointTime(time(0))
+  {
+  }
+
+  //==============================================================================
+  inline bool ReadLoop::IsNeeded(const Registry &reg)
+  {
+    //
+    // Options which are not applied by ReadNtuple::ExecuteRegistry(): TreeCache keys are not
+    // included, python configuration applies them to ROOT automatic cache of ReadNtuple
+    //
+    bool   prune = false, two_phase = false, cache = false, branch_stats = false;
+    std::string checkpoint, stage_dir;
+    int    min_lb = 0, max_lb = 0;
+    int    scan_threads = 0;
+    double frac_min = 0.0, frac_max = 0.0;
+
+    reg.Get("PruneBranches", prune);
+    reg.Get("TwoPhaseRead",  two_phase);
+    reg.Get("EventCache",    cache);
+    reg.Get("BranchStats",   branch_stats);
+    reg.Get("Checkpoint",    checkpoint);
+    reg.Get("StageDir",      stage_dir);
+    reg.Get("MinLB",         min_lb);
+    reg.Get("MaxLB",         max_lb);
+    reg.Get("ScanThreads",   scan_threads);
+    reg.Get("EventFracMin",  frac_min);
+    reg.Get("EventFracMax",  frac_max);
+
+    return prune || two_phase || cache || branch_stats || !checkpoint.empty() || !stage_dir.empty() || min_lb > 0 || max_lb > 0 ||
+      reg.KeyExists("ReplaySkim") || reg.KeyExists("Skims") || frac_min < frac_max || scan_threads > 1;
+  }
+
+  //==============================================================================
+  inline void ReadLoop::DeclareUsage(const Registry &reg)
+  {
+    //
+    // Declared set is made of InputVars/InputPrefixes of algorithm configurations:
+    //  - Lists prefix is kept whole if any declaration overlaps it, so that vectors
+    //    of one list have equal sizes in ReadNtuple, other Lists are not read
+    //  - flat event variables are kept, unless PruneScalars=yes: then only declared
+    //    variables and run/lumi block branches are read
+    //
+    BranchUsage &usage = BranchUsage::Instance();
+
+    DeclareInputs(reg, "ReadNtuple");
+
+    if(usage.IsEmpty()) {
+      std::cout << "ReadLoop::DeclareUsage - algorithms declare no inputs: input branches are not pruned" << std::endl;
+      return;
+    }
+
+    std::vector<std::string> lists;
+    reg.GetVec<std::string>("Lists", lists);
+
+    for(const std::string &prefix: lists) {
+      if(usage.IsOverlap(prefix)) {
+	usage.DeclarePrefix(prefix, "ReadNtuple");
+      }
+    }
+
+    bool prune_scalars = false;
+    reg.Get("PruneScalars", prune_scalars);
+
+    if(prune_scalars) {
+      std::string run_branch = "Run", lb_branch = "LumiBlock";
+      reg.Get("LumiRunBranch", run_branch);
+      reg.Get("LumiLBBranch",  lb_branch);
+
+      usage.DeclareVar(run_branch, "ReadNtuple");
+      usage.DeclareVar(lb_branch,  "ReadNtuple");
+    }
+    else {
+      usage.DeclareScalars("ReadNtuple");
+    }
+  }
+
+  //==============================================================================
+  inline void ReadLoop::Config(const Registry &reg)
+  {
+    reg.Get("Debug",         fDebug);
+    reg.Get("PruneBranches", fPruneBranches);
+    reg.Get("TwoPhaseRead",  fTwoPhaseRead);
+    reg.Get("OutputFile",    fOutputFile);
+
+    //
+    // Entry selection is done by ChunkPlan: ReadNtuple reads every entry it is given
+    //
+    Registry read_reg(reg);
+    read_reg.RemoveKey("InputFiles");
+    read_reg.RemoveKey("NEvent");
+    read_reg.RemoveKey("EventFracMin");
+    read_reg.RemoveKey("EventFracMax");
+
+    read_reg.Set("NEvent", 0);
+
+    if(fPruneBranches) {
+      DeclareUsage(reg);
+
+      if(fDebug) {
+	BranchUsage::Instance().Print();
+      }
+    }
+
+    if(fTwoPhaseRead) {
+      fPrefilter.SetName("Prefilter");
+      fPrefilter.SetDebug(fDebug);
+      fPrefilter.ConfCut("Prefilter", reg);
+
+      if(!fPrefilter.HasCuts()) {
+	log() << "Config - no Prefilter cuts: disable TwoPhaseRead" << std::endl;
+	fTwoPhaseRead = false;
+      }
+      else if(fDebug) {
+	log() << "Config - prefilter cuts:" << std::endl;
+	fPrefilter.PrintConf(std::cout, "   ");
+      }
+    }
+
+    std::vector<std::string> skims;
+    reg.GetVec<std::string>("Skims", skims);
+
+    for(const std::string &skim: skims) {
+      CutFlow &cut = fSkimCuts[skim];
+
+      cut.SetName("Skim" + skim);
+      cut.SetDebug(fDebug);
+      cut.ConfCut("Skim" + skim, reg);
+
+      if(!cut.HasCuts()) {
+	log() << "Config - no cuts for skim: " << skim << std::endl;
+	fSkimCuts.erase(skim);
+      }
+    }
+
+    reg.Get("EventCache",       fCacheEvents);
+    reg.Get("EventCachePasses", fCachePasses);
+
+    if(fCacheEvents && fTwoPhaseRead) {
+      log() << "Config - EventCache can not be used with TwoPhaseRead: disable EventCache" << std::endl;
+      fCacheEvents = false;
+    }
+
+    Registry    cache_alg;
+    std::string cache_alg_type, cache_alg_name;
+
+    if(fCacheEvents && !(reg.Get("EventCacheAlg", cache_alg) &&
+			 cache_alg.Get("AlgType", cache_alg_type) &&
+			 cache_alg.Get("AlgName", cache_alg_name))) {
+      log() << "Config - EventCacheAlg is not configured: cached events have no reader, disable EventCache" << std::endl;
+      fCacheEvents = false;
+    }
+
+    if(fCacheEvents) {
+      double      cache_mb = 512.0, free_mb = 1024.0;
+      std::string spill_dir;
+
+      reg.Get("EventCacheMB",        cache_mb);
+      reg.Get("EventCacheMinFreeMB", free_mb);
+      reg.Get("EventCacheSpillDir",  spill_dir);
+
+      fEventCache.SetDebug(fDebug);
+      fEventCache.SetMemoryBudget(static_cast<long long>(cache_mb*1048576.0));
+      fEventCache.SetMinFreeBytes(static_cast<long long>(free_mb *1048576.0));
+
+      if(!spill_dir.empty()) {
+	fEventCache.SetSpillDir(spill_dir);
+      }
+
+      fEventCacheCut.SetName("EventCache");
+      fEventCacheCut.SetDebug(fDebug);
+      fEventCacheCut.ConfCut("EventCache", reg);
+    }
+
+    std::string checkpoint;
+
+    reg.Get("Checkpoint",       checkpoint);
+    reg.Get("CheckpointNEvent", fCheckpointNEvent);
+    reg.Get("CheckpointSec",    fCheckpointSec);
+    reg.Get("Resume",           fResume);
+
+    if(!checkpoint.empty() && fCacheEvents) {
+      log() << "Config - cached events are not saved by checkpoint: disable Checkpoint" << std::endl;
+      checkpoint.clear();
+    }
+
+    if(!checkpoint.empty()) {
+      //
+      // Members of algorithms are not saved: resumed job would lose their state
+      //
+      std::vector<std::string> safe_types, unsafe;
+      reg.GetVec<std::string>("CheckpointSafeAlgs", safe_types);
+
+      FindUnsafeAlgs(reg, safe_types, unsafe);
+
+      if(!unsafe.empty()) {
+	log() << "Config - state of " << unsafe.size() << " algorithm(s) is not saved by checkpoint: disable Checkpoint" << std::endl;
+
+	for(const std::string &alg: unsafe) {
+	  log() << "Config -    " << alg << std::endl;
+	}
+
+	checkpoint.clear();
+      }
+    }
+
+    fCheckpoint.SetPath(checkpoint);
+
+    fTreeCache.Config(reg);
+    fBranchStats.Config(reg);
+    fFileStage.Config(reg);
+
+    if(fCacheEvents) {
+      //
+      // Replay job: same input configuration, only EventCacheAlg and its own output file
+      //
+      std::string sub_name, replay_output = EventCache::GetReplayPath(fOutputFile);
+      reg.Get("EventCacheOutputFile", replay_output);
+
+      fReplayReg = read_reg;
+
+      if(fReplayReg.Get("SubAlgName", sub_name)) {
+	fReplayReg.RemoveKey(sub_name);
+      }
+
+      fReplayReg.RemoveKey("SubAlgType");
+      fReplayReg.RemoveKey("SubAlgName");
+      fReplayReg.RemoveKey("OutputFile");
+      fReplayReg.RemoveKey("EventCacheAlg");
+
+      fReplayReg.Set("SubAlgType",   cache_alg_type);
+      fReplayReg.Set("SubAlgName",   cache_alg_name);
+      fReplayReg.Set(cache_alg_name, cache_alg);
+
+      if(!replay_output.empty()) {
+	fReplayReg.Set("OutputFile", replay_output);
+      }
+    }
+
+    fRead.Config(read_reg);
+  }
+
+  //==============================================================================
+  inline bool ReadLoop::Init()
+  {
+    const bool result = fRead.Init();
+
+    //
+    // Histograms are restored after algorithms booked them
+    //
+    if(result && !fCheckpoint.GetPath().empty() && IsCheckpointAllowed() && fResume) {
+      LoadCheckpoint();
+    }
+
+    fCheckpointTime = time(0);
+
+    return result;
+  }
+
+  //==============================================================================
+  inline void ReadLoop::ReadChunk(const EventChunk &chunk)
+  {
+    if(chunk.file_path == fFailedPath) {
+      return;
+    }
+
+    long first_entry = chunk.first_entry;
+
+    if(fResumePos.IsValid()) {
+      //
+      // Skip entries read before checkpoint: single process reads chunks in input order
+      //
+      if(long(chunk.file_index) < fResumePos.file_index) {
+	return;
+      }
+      else if(long(chunk.file_index) == fResumePos.file_index) {
+	first_entry = std::max<long>(first_entry, fResumePos.entry);
+      }
+      else {
+	fResumePos = CheckpointPos();
+      }
+
+      if(first_entry >= chunk.last_entry) {
+	return;
+      }
+    }
+
+    if(chunk.file_path != fCurrentPath) {
+      CloseFile();
+
+      if(!OpenFile(chunk.file_path, chunk.tree_name)) {
+	return;
+      }
+    }
+
+    for(long entry = first_entry; entry < chunk.last_entry; ++entry) {
+      ++fNEntry;
+
+      if(!PassPrefilter(entry)) {
+	++fNReject;
+      }
+      else if(fRead.ReadEntry(entry)) {
+	RecordSkims(entry);
+	CacheEvent();
+	++fNEvent;
+      }
+
+      SaveCheckpoint(chunk, entry+1);
+    }
+  }
+
+  //==============================================================================
+  inline void ReadLoop::Done()
+  {
+    CloseFile();
+
+    //
+    // Histograms are owned by output file and written by ReadNtuple::Done()
+    //
+    fBranchStats.Write(GetOutputFile());
+
+    fRead.Done();
+
+    //
+    // Finished job does not resume: output file is written
+    //
+    fCheckpoint.Remove();
+
+    ReplayEventCache();
+
+    fTreeCache.Print();
+    fFileStage.Print();
+
+    fBranchStats.Print();
+    fBranchStats.SaveText();
+
+    if(fTwoPhaseRead) {
+      log() << "Done - prefilter rejected " << fNReject << " of " << fLazyRead.GetNEvent() << " entries" << std::endl;
+      fPrefilter.PrintCuts(std::cout);
+    }
+
+    if(fSkimList.HasRecords() && !fOutputFile.empty()) {
+      const std::string path = SkimList::GetSidecarPath(fOutputFile);
+
+      if(fSkimList.Save(path)) {
+	log() << "Done - wrote entry lists: " << path << std::endl;
+      }
+
+      fSkimList.Print();
+    }
+  }
+
+  //==============================================================================
+  inline bool ReadLoop::OpenFile(const std::string &fpath, const std::string &tree_name)
+  {
+    const std::string read_path = StageInputFile(fpath);
+
+    fTreeCache.Prefetch();
+
+    bool open = fRead.OpenFile(read_path, tree_name);
+
+    if(!open && read_path != fpath) {
+      //
+      // Damaged local copy: remove it and read source
+      //
+      log() << "OpenFile - failed to open local copy, read source: " << fpath << std::endl;
+      fFileStage.Invalidate(fpath);
+
+      open = fRead.OpenFile(fpath, tree_name);
+    }
+
+    fTreeCache.RestorePrefetch();
+
+    if(!open) {
+      std::cerr << "ReadLoop::OpenFile - failed to open: " << fpath << std::endl;
+      fFailedPath = fpath;
+      return false;
+    }
+
+    fCurrentPath = fpath;
+    fSkimList.SetInput(fpath, tree_name);
+    fInputFile   = dynamic_cast<TFile *>(gROOT->GetListOfFiles()->FindObject(read_path.c_str()));
+
+    if(!fInputFile) {
+      fInputFile = dynamic_cast<TFile *>(gROOT->GetListOfFiles()->FindObject(fpath.c_str()));
+    }
+    fInputTree   = 0;
+
+    if(fInputFile) {
+      fInputTree = dynamic_cast<TTree *>(fInputFile->Get(tree_name.c_str()));
+    }
+
+    if(!fInputTree) {
+      log() << "OpenFile - input tree is not found: I/O options are not applied to: " << fpath << std::endl;
+    }
+    else {
+      if(fPruneBranches) {
+	BranchUsage::Instance().PruneTree(fInputTree);
+      }
+
+      fTreeCache.Attach(fInputTree);
+
+      fBranchStats.Attach(fInputTree);
+
+      BindEventVars();
+
+      if(fCacheEvents) {
+	fEventCache.Open(fInputTree);
+      }
+    }
+
+    ++fNFile;
+    return true;
+  }
+
+  //==============================================================================
+  inline std::string ReadLoop::StageInputFile(const std::string &fpath)
+  {
+    //
+    // Returns path to open - local copy if file is staged - and prefetches next
+    // input file while this file is read
+    //
+    if(!fFileStage.IsEnabled()) {
+      return fpath;
+    }
+
+    const std::string local = fFileStage.Stage(fpath);
+
+    std::vector<std::string>::const_iterator fit = std::find(fInputFiles.begin(), fInputFiles.end(), fpath);
+
+    if(fit != fInputFiles.end() && ++fit != fInputFiles.end()) {
+      fFileStage.Prefetch(*fit);
+    }
+
+    if(fDebug && local != fpath) {
+      log() << "StageInputFile - read local copy: " << local << std::endl;
+    }
+
+    return local;
+  }
+
+  //==============================================================================
+  inline void ReadLoop::CloseFile()
+  {
+    if(fCurrentPath.empty()) {
+      return;
+    }
+
+    //
+    // Cache segment is sealed while its input tree is still open
+    //
+    fEventCache.Close();
+
+    fBranchStats.Detach(fInputTree, fInputFile);
+
+    fTreeCache.Detach(fInputTree, fInputFile);
+
+    fLazyRead.SetTree(0);
+    fEventLeaves.clear();
+
+    fRead.CloseFile();
+
+    fCurrentPath.clear();
+    fInputFile = 0;
+    fInputTree = 0;
+  }
+
+  //==============================================================================
+  inline void ReadLoop::BindEventVars()
+  {
+    //
+    // Prefilter and skims use active flat branches named after registered variables:
+    // their addresses are set by ReadNtuple::OpenFile(), values are taken from leaves
+    //
+    fLazyRead.SetTree(0);
+    fEventLeaves.clear();
+
+    if(!fTwoPhaseRead && fSkimCuts.empty() && !fEventCacheCut.HasCuts()) {
+      return;
+    }
+
+    if(fTwoPhaseRead) {
+      fLazyRead.SetTree(fInputTree);
+    }
+
+    TObjArray *branches = fInputTree->GetListOfBranches();
+
+    for(int i = 0; branches && i < branches->GetEntries(); ++i) {
+      TBranch *branch = dynamic_cast<TBranch *>(branches->At(i));
+
+      if(!branch || !fInputTree->GetBranchStatus(branch->GetName()) || !BranchUsage::IsScalar(branch)) {
+	continue;
+      }
+
+      if(!Var::IsKnownVar(branch->GetName())) {
+	continue;
+      }
+
+      TLeaf *leaf = dynamic_cast<TLeaf *>(branch->GetListOfLeaves()->At(0));
+
+      if(!leaf) {
+	continue;
+      }
+
+      if(fTwoPhaseRead) {
+	fLazyRead.AddEventBranch(branch->GetName());
+      }
+
+      fEventLeaves.push_back(LeafVec::value_type(leaf, Var::ConvertStr2Var(branch->GetName())));
+    }
+
+    if(fDebug) {
+      log() << "BindEventVars - " << fEventLeaves.size() << " event variable branch(es)" << std::endl;
+    }
+  }
+
+  //==============================================================================
+  inline void ReadLoop::FillEventVars()
+  {
+    fEventVars.ClearVars();
+
+    for(const LeafVec::value_type &leaf: fEventLeaves) {
+      fEventVars.AddVar(leaf.second, leaf.first->GetValue());
+    }
+  }
+
+  //==============================================================================
+  inline bool ReadLoop::PassPrefilter(long entry)
+  {
+    if(!fTwoPhaseRead || !fLazyRead.IsValid()) {
+      return true;
+    }
+
+    if(!fLazyRead.LoadEvent(entry)) {
+      return false;
+    }
+
+    FillEventVars();
+
+    return fPrefilter.PassCut(fEventVars) != Cut::Fail;
+  }
+
+  //==============================================================================
+  inline void ReadLoop::RecordSkims(long entry)
+  {
+    //
+    // Called after ReadNtuple::ReadEntry(): leaves hold values of this entry
+    //
+    if(fSkimCuts.empty()) {
+      return;
+    }
+
+    fSkimList.SetEntry(entry);
+
+    FillEventVars();
+
+    for(SkimMap::value_type &skim: fSkimCuts) {
+      if(skim.second.PassCut(fEventVars) == Cut::Pass) {
+	fSkimList.Record(skim.first);
+      }
+    }
+  }
+
+  //==============================================================================
+  inline void ReadLoop::CacheEvent()
+  {
+    //
+    // Called after ReadNtuple::ReadEntry(): clone buffers hold this entry
+    //
+    if(!fCacheEvents) {
+      return;
+    }
+
+    if(fEventCacheCut.HasCuts()) {
+      FillEventVars();
+
+      if(fEventCacheCut.PassCut(fEventVars) == Cut::Fail) {
+	return;
+      }
+    }
+
+    fEventCache.Fill();
+  }
+
+  //==============================================================================
+  inline void ReadLoop::ReplayEventCache()
+  {
+    //
+    // Called by Done() after job algorithms are finalized: only cache segments are read
+    //
+    if(!fCacheEvents || fEventCache.GetNEvent() < 1) {
+      return;
+    }
+
+    fEventCache.Print();
+
+    if(!fEventCache.IsComplete()) {
+      log() << "ReplayEventCache - cache is incomplete: cached events are not replayed" << std::endl;
+      fEventCache.Clear();
+      return;
+    }
+
+    //
+    // All segments are written to local files before first pass: passes read same events
+    //
+    std::vector<std::string> paths;
+
+    for(unsigned i = 0; i < fEventCache.GetNSegment(); ++i) {
+      paths.push_back(fEventCache.GetSegmentPath(i));
+
+      if(paths.back().empty()) {
+	log() << "ReplayEventCache - failed to write cache segment #" << i << ": cached events are not replayed" << std::endl;
+	fEventCache.Clear();
+	return;
+      }
+    }
+
+    ReadNtuple replay;
+    replay.Config(fReplayReg);
+
+    if(!replay.Init()) {
+      log() << "ReplayEventCache - failed to initialize EventCacheAlg" << std::endl;
+      fEventCache.Clear();
+      return;
+    }
+
+    for(unsigned pass = 1; pass <= fCachePasses; ++pass) {
+      TStopwatch timer;
+      timer.Start();
+
+      EventCache::SetPass(pass);
+
+      for(unsigned i = 0; i < paths.size(); ++i) {
+	if(!replay.OpenFile(paths.at(i), "cache")) {
+	  log() << "ReplayEventCache - failed to read cache segment #" << i << std::endl;
+	  continue;
+	}
+
+	for(long entry = 0; entry < fEventCache.GetSegmentNEvent(i); ++entry) {
+	  replay.ReadEntry(entry);
+	}
+
+	replay.CloseFile();
+      }
+
+      log() << "ReplayEventCache - pass #" << pass << " read " << fEventCache.GetNEvent()
+	    << " cached event(s) in " << PrintResetStopWatch(timer) << std::endl;
+    }
+
+    EventCache::SetPass(0);
+
+    replay.Done();
+
+    fEventCache.Clear();
+  }
+
+  //==============================================================================
+  inline bool ReadLoop::LoadCheckpoint()
+  {
+    if(!fCheckpoint.Exists()) {
+      return false;
+    }
+
+    CheckpointPos pos;
+    Registry      state;
+    std::string   text;
+
+    if(!fCheckpoint.Load(pos, state, text)) {
+      return false;
+    }
+
+    if(pos.file_index < 0 || pos.file_index >= long(fInputFiles.size()) || fInputFiles.at(pos.file_index) != pos.file_path) {
+      log() << "LoadCheckpoint - input files do not match checkpoint: start from first file" << std::endl;
+      return false;
+    }
+
+    LoadCutState(state);
+
+    std::stringstream skims(text);
+    fSkimList.Read(skims);
+
+    state.Get("NReject", fNReject);
+    fCheckpoint.RestoreHists(GetOutputFile());
+
+    fResumePos = pos;
+    fNEvent    = pos.icount;
+
+    log() << "LoadCheckpoint - resume from entry " << pos.entry << " of file #" << pos.file_index
+	  << " after " << pos.icount << " event(s): " << pos.file_path << std::endl;
+
+    return true;
+  }
+
+  //==============================================================================
+  inline void ReadLoop::SaveCheckpoint(const EventChunk &chunk, long next_entry)
+  {
+    if(fCheckpoint.GetPath().empty()) {
+      return;
+    }
+
+    bool save = fCheckpointNEvent > 0 && fNEntry % fCheckpointNEvent == 0;
+
+    if(!save && fCheckpointSec > 0 && fNEntry % 1000 == 0) {
+      save = time(0) - fCheckpointTime >= time_t(fCheckpointSec);
+    }
+
+    if(!save || !IsCheckpointAllowed()) {
+      return;
+    }
+
+    CheckpointPos pos;
+    pos.file_path  = chunk.file_path;
+    pos.file_index = chunk.file_index;
+    pos.entry      = next_entry;
+    pos.icount     = fNEvent;
+
+    Registry state;
+    SaveCutState(state);
+    state.Set("NReject", fNReject);
+
+    std::stringstream skims;
+    fSkimList.Write(skims);
+
+    if(fCheckpoint.Save(pos, state, skims.str(), GetOutputFile()) && fDebug) {
+      log() << "SaveCheckpoint - entry " << next_entry << " of file #" << pos.file_index
+	    << " after " << fNEvent << " event(s)" << std::endl;
+    }
+
+    fCheckpointTime = time(0);
+  }
+
+  //==============================================================================
+  inline void ReadLoop::SaveCutState(Registry &state) const
+  {
+    Registry prefilter, cache;
+
+    fPrefilter    .SaveState(prefilter);
+    fEventCacheCut.SaveState(cache);
+
+    state.Set("Prefilter",  prefilter);
+    state.Set("EventCache", cache);
+
+    for(const SkimMap::value_type &skim: fSkimCuts) {
+      Registry cut;
+      skim.second.SaveState(cut);
+      state.Set("Skim" + skim.first, cut);
+    }
+  }
+
+  //==============================================================================
+  inline void ReadLoop::LoadCutState(const Registry &state)
+  {
+    Registry cut;
+
+    if(state.Get("Prefilter", cut)) {
+      fPrefilter.LoadState(cut);
+    }
+
+    if(state.Get("EventCache", cut)) {
+      fEventCacheCut.LoadState(cut);
+    }
+
+    for(SkimMap::value_type &skim: fSkimCuts) {
+      if(state.Get("Skim" + skim.first, cut)) {
+	skim.second.LoadState(cut);
+      }
+    }
+  }
+
+  //==============================================================================
+  inline bool ReadLoop::IsCheckpointAllowed()
+  {
+    //
+    // Checkpoint keeps histograms only: entries of output trees would be lost on resume
+    //
+    if(Checkpoint::HasTrees(GetOutputFile())) {
+      log() << "IsCheckpointAllowed - OutputFile contains output trees: disable Checkpoint" << std::endl;
+      fCheckpoint.SetPath("");
+      return false;
+    }
+
+    return true;
+  }
+
+  //==============================================================================
+  inline TFile* ReadLoop::GetOutputFile() const
+  {
+    return dynamic_cast<TFile *>(gROOT->GetListOfFiles()->FindObject(fOutputFile.c_str()));
+  }
+
+  //==============================================================================
+  inline void ReadLoop::DeclareInputs(const Registry &reg, const std::string &caller)
+  {
+    //
+    // InputVars/InputPrefixes keys of algorithm configurations - see AlgConfig.DeclareInputs()
+    //
+    BranchUsage &usage = BranchUsage::Instance();
+
+    std::vector<std::string> vars, prefixes;
+
+    reg.GetVec<std::string>("InputVars",     vars);
+    reg.GetVec<std::string>("InputPrefixes", prefixes);
+
+    for(const std::string &var: vars) {
+      usage.DeclareVar(var, caller);
+    }
+
+    for(const std::string &prefix: prefixes) {
+      usage.DeclarePrefix(prefix, caller);
+    }
+
+    for(const Registry::RegData &d: reg.GetReg()) {
+      DeclareInputs(d.GetData(), d.GetKey());
+    }
+  }
+
+  //==============================================================================
+  inline void ReadLoop::FindUnsafeAlgs(const Registry &reg, const std::vector<std::string> &safe_types, std::vector<std::string> &unsafe)
+  {
+    //
+    // Algorithm configurations are sub-registries with AlgType key - see AlgConfig.SetCheckpointSafe()
+    //
+    for(const Registry::RegData &d: reg.GetReg()) {
+      const Registry &alg_reg = d.GetData();
+
+      std::string alg_type;
+      bool        safe = false;
+
+      if(alg_reg.Get("AlgType", alg_type)) {
+	alg_reg.Get("CheckpointSafe", safe);
+
+	if(!safe && std::find(safe_types.begin(), safe_types.end(), alg_type) == safe_types.end()) {
+	  unsafe.push_back(d.GetKey() + " (" + alg_type + ")");
+	}
+      }
+
+      FindUnsafeAlgs(alg_reg, safe_types, unsafe);
+    }
+  }
+
+  //==============================================================================
+  inline std::ostream& ReadLoop::log() const
+  {
+    std::cout << "ReadLoop::";
+    return std::cout;
+  }
+}
+
+#endif
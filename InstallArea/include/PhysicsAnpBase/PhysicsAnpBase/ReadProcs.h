@@ -0,0 +1,429 @@
+// -*- c++ -*-
+#ifndef ANP_READPROCS_H
+#define ANP_READPROCS_H
+
+/**********************************************************************************
+ * @Package: PhysicsAnpBase
+ * @Class  : ReadProcs
+ * @Author : Rustem Ospanov
+ *
+ * @Brief  : Multi-process event loop: fork NProcs ReadNtuple workers and merge outputs
+ *
+ *  - parent process forks NProcs children after reading job configuration
+ *  - each child configures its own ReadNtuple and writes its own partial output
+ *  - input files are split into chunks by ChunkPlan before fork: children take
+ *    chunks from ChunkScheduler deques in shared memory and steal chunks from
+ *    other children when their own deques are empty
+ *  - parent waits for all children and merges partial outputs (TH1, TH2, TTree
+ *    and saved cut-flow histograms) into OutputFile
+ *  - outputs of EventCache replay jobs of children are merged separately into
+ *    EventCacheOutputFile (see ReadLoop)
+ *
+ *  MinLB/MaxLB, ReplaySkim, EventFracMin/Max and ChunkMB are applied by ChunkPlan.
+ *  Each child reads its chunks with ReadLoop.
+ *
+ *  NProcs < 2: chunks are read by ReadLoop in this process if ReadLoop::IsNeeded(),
+ *  otherwise job is run by ReadNtuple::ExecuteRegistry(). Python configuration calls
+ *  ReadNtuple::ExecuteRegistry() directly when IsNeeded() is false, so that default
+ *  single process jobs do not depend on this class at all.
+ *
+ *  Children share no memory with each other except for the chunk deques,
+ *  so algorithms do not need to be thread safe.
+ *
+ *  Child exits with status 1 if its algorithms fail to initialize (its chunks are
+ *  then read by other children) or if its partial output file is not written:
+ *  parent merges outputs only when all children exit with status 0.
+ *
+ **********************************************************************************/
+
+// C/C++
+#include <algorithm>
+#include <cstdio>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// POSIX
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// ROOT
+#include "TFileMerger.h"
+#include "TStopwatch.h"
+
+// Base
+#include "PhysicsAnpBase/ChunkPlan.h"
+#include "PhysicsAnpBase/ChunkScheduler.h"
+#include "PhysicsAnpBase/EventChunk.h"
+#include "PhysicsAnpBase/ReadLoop.h"
+#include "PhysicsAnpBase/ReadNtuple.h"
+#include "PhysicsAnpBase/Registry.h"
+#include "PhysicsAnpBase/SkimList.h"
+#include "PhysicsAnpBase/UtilBase.h"
+
+namespace Anp
+{
+  class ReadProcs
+  {
+  public:
+
+    ReadProcs();
+    ~ReadProcs() {}
+
+    static bool IsNeeded(const Registry &reg);
+
+    void ExecuteRegistry(const Registry &reg);
+
+
+  private:
+
+    bool Config(const Registry &reg);
+
+    bool RunChild(unsigned index);
+
+    bool RunLoop(unsigned index, const Registry &reg);
+
+    void Merge();
+
+    bool MergeFiles(const std::vector<std::string> &inputs, const std::string &output);
+
+    std::string GetChildPath(unsigned index) const;
+
+    std::ostream& log() const;
+
+  private:
+
+    ReadProcs(const ReadProcs &);
+    ReadProcs& operator=(const ReadProcs &);
+
+  private:
+
+    TStopwatch                 fTimerTotal;         // Total processing timer
+    Registry                   fReg;                // Job configuration
+
+    // Properties:
+    bool                       fDebug;              // Print debug info
+    std::string                fOutputFile;         // Name of merged output ROOT file
+    std::string                fReplayFile;         // Name of merged output of EventCache replay
+    unsigned                   fNProcs;             // Number of child processes
+
+    // Variables:
+    std::vector<std::string>   fInputFiles;         // Input files
+    std::vector<std::string>   fChildFiles;         // Partial outputs of children
+    ChunkPlan                  fPlan;               // Split of input files into chunks
+    ChunkScheduler             fScheduler;          // Work-stealing chunk deques in shared memory
+  };
+
+  //==============================================================================
+  // Inlined functions
+  //==============================================================================
+  inline ReadProcs::ReadProcs()
+    :fDebug (false),
+     fNProcs(1)
+  {
+  }
+
+  //==============================================================================
+  inline bool ReadProcs::IsNeeded(const Registry &reg)
+  {
+    unsigned nprocs = 1;
+    reg.Get("NProcs", nprocs);
+
+    return nprocs > 1 || ReadLoop::IsNeeded(reg);
+  }
+
+  //==============================================================================
+  inline void ReadProcs::ExecuteRegistry(const Registry &reg)
+  {
+    reg.Get("NProcs", fNProcs);
+
+    if(!IsNeeded(reg)) {
+      //
+      // Single process - keep default ReadNtuple event loop
+      //
+      ReadNtuple read;
+      read.ExecuteRegistry(reg);
+      return;
+    }
+
+    fNProcs = std::max<unsigned>(fNProcs, 1);
+
+    fTimerTotal.Start();
+
+    if(!Config(reg)) {
+      log() << "ExecuteRegistry - failed to configure job" << std::endl;
+      return;
+    }
+
+    if(fNProcs == 1) {
+      //
+      // Single process - read chunks with ReadLoop in this process
+      //
+      if(!RunLoop(0, fReg)) {
+	log() << "ExecuteRegistry - event loop failed" << std::endl;
+      }
+
+      log() << "ExecuteRegistry - total time: " << PrintResetStopWatch(fTimerTotal) << std::endl;
+      return;
+    }
+
+    //
+    // Flush output streams so that children do not repeat buffered output
+    //
+    std::cout << std::flush;
+    std::cerr << std::flush;
+
+    std::vector<pid_t> pids;
+
+    for(unsigned i = 0; i < fNProcs; ++i) {
+      const pid_t pid = fork();
+
+      if(pid == 0) {
+	const bool ok = RunChild(i);
+	std::cout << std::flush;
+	std::cerr << std::flush;
+	_exit(ok ? 0 : 1);
+      }
+      else if(pid < 0) {
+	log() << "ExecuteRegistry - fork failed for child #" << i << std::endl;
+	continue;
+      }
+
+      pids.push_back(pid);
+    }
+
+    unsigned nfail = 0;
+
+    for(pid_t pid: pids) {
+      int status = 0;
+
+      if(waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+	log() << "ExecuteRegistry - child pid=" << pid << " failed with status=" << status << std::endl;
+	++nfail;
+      }
+    }
+
+    log() << "ExecuteRegistry - " << pids.size() << " child process(es) processed "
+	  << fScheduler.GetNChunk() << " chunk(s) of " << fInputFiles.size() << " file(s)" << std::endl;
+
+    fScheduler.Print();
+
+    if(nfail == 0) {
+      Merge();
+    }
+    else {
+      log() << "ExecuteRegistry - " << nfail << " failed child process(es): keep partial outputs" << std::endl;
+    }
+
+    log() << "ExecuteRegistry - total time: " << PrintResetStopWatch(fTimerTotal) << std::endl;
+  }
+
+  //==============================================================================
+  inline bool ReadProcs::Config(const Registry &reg)
+  {
+    fReg = reg;
+
+    reg.Get("Debug",      fDebug);
+    reg.Get("OutputFile", fOutputFile);
+
+    bool cache = false;
+    reg.Get("EventCache", cache);
+
+    if(cache && reg.KeyExists("EventCacheAlg")) {
+      fReplayFile = EventCache::GetReplayPath(fOutputFile);
+      reg.Get("EventCacheOutputFile", fReplayFile);
+    }
+
+    Registry input_reg;
+    if(reg.Get("InputFiles", input_reg)) {
+      for(const Registry::StrData &d: input_reg.GetStr()) {
+	if(d.GetKey() == "File") {
+	  fInputFiles.push_back(d.GetData());
+	}
+      }
+    }
+
+    if(fInputFiles.empty()) {
+      log() << "Config - no input files" << std::endl;
+      return false;
+    }
+
+    //
+    // Chunks are made once in parent: deques are shared by children after fork
+    //
+    fPlan.Config(reg);
+
+    bool prune = false;
+    reg.Get("PruneBranches", prune);
+
+    if(prune) {
+      //
+      // Branches declared before fork: ChunkMB counts only bytes of branches which are read
+      //
+      ReadLoop::DeclareUsage(reg);
+    }
+
+    ChunkVec chunks;
+
+    if(!fPlan.Make(fInputFiles, chunks) || !fScheduler.Init(chunks, fNProcs, fNProcs > 1)) {
+      return false;
+    }
+
+    for(unsigned i = 0; i < fNProcs && fNProcs > 1; ++i) {
+      fChildFiles.push_back(GetChildPath(i));
+    }
+
+    return true;
+  }
+
+  //==============================================================================
+  inline bool ReadProcs::RunChild(unsigned index)
+  {
+    Registry child_reg(fReg);
+    child_reg.RemoveKey("NProcs");
+    child_reg.RemoveKey("OutputFile");
+    child_reg.RemoveKey("Checkpoint");
+    child_reg.RemoveKey("BranchStatsText");
+    child_reg.RemoveKey("EventCacheOutputFile");
+
+    child_reg.Set("OutputFile", fChildFiles.at(index));
+
+    return RunLoop(index, child_reg);
+  }
+
+  //==============================================================================
+  inline bool ReadProcs::RunLoop(unsigned index, const Registry &reg)
+  {
+    ReadLoop loop;
+    loop.SetInputFiles(fInputFiles);
+    loop.Config(reg);
+
+    if(!loop.Init()) {
+      //
+      // Do not take chunks: they are left to other workers
+      //
+      std::cerr << "ReadProcs::RunLoop - worker #" << index << " failed to initialize algorithms" << std::endl;
+      return false;
+    }
+
+    EventChunk chunk;
+
+    while(fScheduler.Next(index, chunk)) {
+      loop.ReadChunk(chunk);
+    }
+
+    loop.Done();
+
+    if(fDebug) {
+      log() << "RunLoop - worker #" << index << " opened " << loop.GetNFile() << " file(s), processed "
+	    << fScheduler.GetNPop(index) + fScheduler.GetNSteal(index) << " chunk(s) ("
+	    << fScheduler.GetNSteal(index) << " stolen) and " << loop.GetNEvent() << " event(s)" << std::endl;
+    }
+
+    std::string output_file;
+    reg.Get("OutputFile", output_file);
+
+    struct stat info;
+
+    if(!output_file.empty() && (stat(output_file.c_str(), &info) != 0 || info.st_size == 0)) {
+      std::cerr << "ReadProcs::RunLoop - worker #" << index << " did not write output file: " << output_file << std::endl;
+      return false;
+    }
+
+    return true;
+  }
+
+  //==============================================================================
+  inline void ReadProcs::Merge()
+  {
+    if(fOutputFile.empty()) {
+      return;
+    }
+
+    if(!MergeFiles(fChildFiles, fOutputFile)) {
+      return;
+    }
+
+    if(!fReplayFile.empty()) {
+      //
+      // Children which cached no events do not write replay output
+      //
+      std::vector<std::string> replay_paths;
+
+      for(const std::string &path: fChildFiles) {
+	struct stat st;
+
+	if(stat(EventCache::GetReplayPath(path).c_str(), &st) == 0) {
+	  replay_paths.push_back(EventCache::GetReplayPath(path));
+	}
+      }
+
+      if(!replay_paths.empty()) {
+	MergeFiles(replay_paths, fReplayFile);
+      }
+    }
+
+    std::vector<std::string> skim_paths;
+
+    for(const std::string &path: fChildFiles) {
+      skim_paths.push_back(SkimList::GetSidecarPath(path));
+    }
+
+    if(SkimList::MergeFiles(skim_paths, SkimList::GetSidecarPath(fOutputFile))) {
+      log() << "Merge - merged entry lists into: " << SkimList::GetSidecarPath(fOutputFile) << std::endl;
+    }
+  }
+
+  //==============================================================================
+  inline bool ReadProcs::MergeFiles(const std::vector<std::string> &inputs, const std::string &output)
+  {
+    TFileMerger merger(false);
+    merger.OutputFile(output.c_str(), "RECREATE");
+
+    for(const std::string &path: inputs) {
+      merger.AddFile(path.c_str(), false);
+    }
+
+    if(!merger.Merge()) {
+      log() << "MergeFiles - failed to merge outputs into: " << output << std::endl;
+      return false;
+    }
+
+    for(const std::string &path: inputs) {
+      std::remove(path.c_str());
+    }
+
+    log() << "MergeFiles - merged " << inputs.size() << " partial output(s) into: " << output << std::endl;
+    return true;
+  }
+
+  //==============================================================================
+  inline std::string ReadProcs::GetChildPath(unsigned index) const
+  {
+    if(fOutputFile.empty()) {
+      return "";
+    }
+
+    std::string stem = fOutputFile;
+
+    if(stem.size() > 5 && stem.substr(stem.size()-5) == ".root") {
+      stem = stem.substr(0, stem.size()-5);
+    }
+
+    std::stringstream path;
+    path << stem << "_proc" << index << ".root";
+
+    return path.str();
+  }
+
+  //==============================================================================
+  inline std::ostream& ReadProcs::log() const
+  {
+    std::cout << "ReadProcs::";
+    return std::cout;
+  }
+}
+
+#endif
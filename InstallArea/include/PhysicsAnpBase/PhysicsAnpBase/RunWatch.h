@@ -0,0 +1,328 @@
+// -*- c++ -*-
+#ifndef ANP_RUNWATCH_H
+#define ANP_RUNWATCH_H
+
+/**********************************************************************************
+ * @Package: PhysicsAnpBase
+ * @Class  : RunWatch
+ * @Author : Rustem Ospanov
+ *
+ * @Brief  : Incremental processing of new files in watched directory with RunModule
+ *
+ *  RunWatch drives RunModule through its public interface (WatchDir=<path>):
+ *
+ *  - Config()  - read Watch keys and OutputFile
+ *  - Exec()    - called after RunModule::Init() instead of RunModule::Exec():
+ *                new files in WatchDir are found with inotify (DirWatch) as soon
+ *                as they are closed by writer and are read by RunModule::Exec()
+ *                with the same algorithms
+ *  - Done()    - called after RunModule::Done() wrote output file
+ *
+ *  Every WatchSnapshotSec seconds, if new files were read, in-memory objects of
+ *  output file (histograms, not trees) are copied into WatchSnapshotFile (default is
+ *  OutputFile with "_snapshot" suffix): snapshot is written to temporary file and
+ *  renamed, so that readers never see partial snapshot. Output file itself is written
+ *  only once by RunModule::Done(). Files are appended to WatchLedger by Done(), after
+ *  output file with their events was written, and are never processed again, also
+ *  by restarted job.
+ *
+ *  Loop stops when WatchStopFile exists or after WatchIdleSec seconds without new
+ *  files (0 - never). NEvent is applied by RunModule.
+ *
+ **********************************************************************************/
+
+// C/C++
+#include <cstdio>
+#include <ctime>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// POSIX
+#include <unistd.h>
+
+// ROOT
+#include "TDirectory.h"
+#include "TFile.h"
+#include "TROOT.h"
+#include "TTree.h"
+
+// Base
+#include "PhysicsAnpBase/DirWatch.h"
+#include "PhysicsAnpBase/Registry.h"
+#include "PhysicsAnpBase/RunModule.h"
+
+namespace Anp
+{
+  class RunWatch
+  {
+  public:
+
+    RunWatch();
+    ~RunWatch() {}
+
+    static bool IsNeeded(const Registry &reg) { return reg.KeyExists("WatchDir"); }
+
+    void Config(const Registry &reg);
+
+    void Exec(RunModule &run);
+
+    void Done();
+
+  private:
+
+    bool IsValidFile(const std::string &path) const;
+
+    void WriteSnapshot();
+
+    static void CopyObjects(TDirectory *source, TDirectory *target);
+
+    std::ostream& log() const;
+
+  private:
+
+    RunWatch(const RunWatch &);
+    RunWatch& operator=(const RunWatch &);
+
+  private:
+
+    DirWatch                   fWatch;              // inotify watch of WatchDir
+
+    // Properties:
+    bool                       fDebug;              // Print debug info
+    std::string                fOutputFile;         // Output file written by RunModule
+    std::string                fTreeName;           // Name of input tree
+    std::string                fWatchDir;           // Directory watched for new input files
+    std::string                fWatchSuffix;        // Suffix of watched input files
+    std::string                fWatchLedger;        // Text file with names of processed files
+    std::string                fWatchStopFile;      // Stop watch loop when this file exists
+    std::string                fWatchSnapshotFile;  // File with latest snapshot of output objects
+    unsigned                   fWatchSnapshotSec;   // Seconds between output snapshots
+    unsigned                   fWatchIdleSec;       // Stop watch loop after this many idle seconds (0 - never)
+
+    // Variables:
+    std::vector<std::string>   fPending;            // Files read since last written output
+    long                       fNFile;              // Number of read files
+    long                       fNFileSnapshot;      // Number of read files at last snapshot
+  };
+
+  //==============================================================================
+  // Inlined functions
+  //==============================================================================
+  inline RunWatch::RunWatch()
+    :fDebug           (false),
+     fWatchSuffix     (".root"),
+     fWatchSnapshotSec(300),
+     fWatchIdleSec    (0),
+     fNFile           (0),
+     fNFileSnapshot   (0)
+  {
+  }
+
+  //==============================================================================
+  inline void RunWatch::Config(const Registry &reg)
+  {
+    reg.Get("Debug",            fDebug);
+    reg.Get("OutputFile",       fOutputFile);
+    reg.Get("TreeName",         fTreeName);
+    reg.Get("WatchDir",         fWatchDir);
+    reg.Get("WatchSuffix",      fWatchSuffix);
+    reg.Get("WatchLedger",      fWatchLedger);
+    reg.Get("WatchStopFile",    fWatchStopFile);
+    reg.Get("WatchSnapshotSec", fWatchSnapshotSec);
+    reg.Get("WatchIdleSec",     fWatchIdleSec);
+
+    fWatchSnapshotFile = fOutputFile;
+
+    if(fWatchSnapshotFile.size() > 5 && fWatchSnapshotFile.substr(fWatchSnapshotFile.size()-5) == ".root") {
+      fWatchSnapshotFile = fWatchSnapshotFile.substr(0, fWatchSnapshotFile.size()-5);
+    }
+
+    if(!fWatchSnapshotFile.empty()) {
+      fWatchSnapshotFile += "_snapshot.root";
+    }
+
+    reg.Get("WatchSnapshotFile", fWatchSnapshotFile);
+  }
+
+  //==============================================================================
+  inline void RunWatch::Exec(RunModule &run)
+  {
+    if(!fWatch.Open(fWatchDir, fWatchSuffix)) {
+      log() << "Exec - failed to watch directory: " << fWatchDir << std::endl;
+      return;
+    }
+
+    if(!fWatchLedger.empty() && fWatch.SetLedger(fWatchLedger)) {
+      log() << "Exec - skip " << fWatch.GetNDone() << " file(s) listed in ledger: " << fWatchLedger << std::endl;
+    }
+
+    log() << "Exec - watching " << fWatchDir << " for new *" << fWatchSuffix << " files" << std::endl;
+
+    time_t last_file     = time(0);
+    time_t last_snapshot = time(0);
+
+    while(true) {
+      if(!fWatchStopFile.empty() && access(fWatchStopFile.c_str(), F_OK) == 0) {
+	log() << "Exec - found stop file: " << fWatchStopFile << std::endl;
+	break;
+      }
+
+      std::vector<std::string> paths;
+
+      if(!fWatch.Wait(1000, paths)) {
+	break;
+      }
+
+      if(!paths.empty()) {
+	run.ClearInputFiles();
+
+	for(const std::string &path: paths) {
+	  if(IsValidFile(path)) {
+	    run.AddInputFile(path);
+	    fPending.push_back(path);
+	    ++fNFile;
+	  }
+	}
+
+	run.Exec();
+
+	last_file = time(0);
+      }
+
+      const time_t now = time(0);
+
+      if(fNFile > fNFileSnapshot && fWatchSnapshotSec > 0 && now - last_snapshot >= time_t(fWatchSnapshotSec)) {
+	WriteSnapshot();
+	last_snapshot = now;
+      }
+
+      if(fWatchIdleSec > 0 && now - last_file >= time_t(fWatchIdleSec)) {
+	log() << "Exec - no new files for " << fWatchIdleSec << " seconds" << std::endl;
+	break;
+      }
+    }
+
+    run.ClearInputFiles();
+
+    log() << "Exec - read " << fNFile << " new file(s)" << std::endl;
+  }
+
+  //==============================================================================
+  inline void RunWatch::Done()
+  {
+    //
+    // Called after RunModule::Done() wrote output file
+    //
+    for(const std::string &path: fPending) {
+      fWatch.MarkDone(path);
+    }
+
+    fPending.clear();
+    fWatch.Close();
+  }
+
+  //==============================================================================
+  inline bool RunWatch::IsValidFile(const std::string &path) const
+  {
+    //
+    // Files which can not be read are not recorded in ledger: restarted job retries them
+    //
+    TFile *file = TFile::Open(path.c_str(), "READ");
+
+    const bool valid = file && file->IsOpen() && !file->IsZombie() &&
+      (fTreeName.empty() || dynamic_cast<TTree *>(file->Get(fTreeName.c_str())));
+
+    if(!valid) {
+      std::cerr << "RunWatch::IsValidFile - failed to read tree \"" << fTreeName << "\" from: " << path << std::endl;
+    }
+
+    if(file) {
+      file->Close();
+      delete file;
+    }
+
+    return valid;
+  }
+
+  //==============================================================================
+  inline void RunWatch::WriteSnapshot()
+  {
+    //
+    // Output file is not written here: RunModule::Done() writes it once, without old cycles
+    //
+    TFile *file = dynamic_cast<TFile *>(gROOT->GetListOfFiles()->FindObject(fOutputFile.c_str()));
+
+    if(!file || fWatchSnapshotFile.empty()) {
+      log() << "WriteSnapshot - output file is not open: " << fOutputFile << std::endl;
+      return;
+    }
+
+    const std::string tmp_path = fWatchSnapshotFile + ".tmp";
+
+    TDirectory *dir  = gDirectory;
+    TFile      *snap = TFile::Open(tmp_path.c_str(), "RECREATE");
+
+    if(!snap || !snap->IsOpen()) {
+      log() << "WriteSnapshot - failed to create: " << tmp_path << std::endl;
+      delete snap;
+
+      if(dir) {
+	dir->cd();
+      }
+
+      return;
+    }
+
+    CopyObjects(file, snap);
+
+    snap->Close();
+    delete snap;
+
+    if(dir) {
+      dir->cd();
+    }
+
+    if(std::rename(tmp_path.c_str(), fWatchSnapshotFile.c_str()) != 0) {
+      log() << "WriteSnapshot - failed to rename snapshot: " << fWatchSnapshotFile << std::endl;
+      return;
+    }
+
+    fNFileSnapshot = fNFile;
+
+    if(fDebug) {
+      log() << "WriteSnapshot - wrote " << fWatchSnapshotFile << std::endl;
+    }
+  }
+
+  //==============================================================================
+  inline void RunWatch::CopyObjects(TDirectory *source, TDirectory *target)
+  {
+    //
+    // Trees are written only by RunModule::Done(): they are owned by output file
+    //
+    TIter next(source->GetList());
+
+    while(TObject *obj = next()) {
+      if(TDirectory *sub = dynamic_cast<TDirectory *>(obj)) {
+	TDirectory *copy = target->mkdir(sub->GetName());
+
+	if(copy) {
+	  CopyObjects(sub, copy);
+	}
+      }
+      else if(!dynamic_cast<TTree *>(obj)) {
+	target->WriteTObject(obj, obj->GetName());
+      }
+    }
+  }
+
+  //==============================================================================
+  inline std::ostream& RunWatch::log() const
+  {
+    std::cout << "RunWatch::";
+    return std::cout;
+  }
+}
+
+#endif
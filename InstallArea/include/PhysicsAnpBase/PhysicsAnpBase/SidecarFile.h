@@ -0,0 +1,180 @@
+// -*- c++ -*-
+#ifndef ANP_SIDECARFILE_H
+#define ANP_SIDECARFILE_H
+
+/**********************************************************************************
+ * @Package: PhysicsAnpBase
+ * @Class  : SidecarFile
+ * @Author : Rustem Ospanov
+ *
+ * @Brief  : Helper functions for index files of input directories
+ *
+ *  Index files (EntryIndex, LumiIndex) are kept under private index directory
+ *  and never written into input directories, which are often shared and read-only:
+ *
+ *    <index dir>/<resolved input dir>/<sidecar name>
+ *
+ *  Default index directory is $ANP_INDEX_DIR or $HOME/.anp_index: empty index
+ *  directory disables index files.
+ *
+ *  Lines are tab separated, so that file and tree names may contain spaces.
+ *
+ *  SidecarLock holds exclusive flock() on "<sidecar>.lock" while index file is
+ *  re-read, merged with new entries and replaced: concurrent jobs never lose
+ *  entries written by other jobs.
+ *
+ **********************************************************************************/
+
+// C/C++
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// POSIX
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace Anp
+{
+  //==============================================================================
+  class SidecarLock
+  {
+  public:
+
+    explicit SidecarLock(const std::string &spath);
+    ~SidecarLock();
+
+    bool IsLocked() const { return fFd >= 0; }
+
+  private:
+
+    SidecarLock(const SidecarLock &);
+    SidecarLock& operator=(const SidecarLock &);
+
+  private:
+
+    int   fFd;
+  };
+
+  //==============================================================================
+  // Helper functions
+  //==============================================================================
+  inline std::string GetDefaultSidecarDir()
+  {
+    const char *dir = std::getenv("ANP_INDEX_DIR");
+
+    if(dir) {
+      return dir;
+    }
+
+    const char *home = std::getenv("HOME");
+
+    if(home && home[0] != '\0') {
+      return std::string(home) + "/.anp_index";
+    }
+
+    return "";
+  }
+
+  //==============================================================================
+  inline std::string GetSidecarPath(const std::string &index_dir, const std::string &fpath, const std::string &name)
+  {
+    //
+    // Index file for directory of input file fpath: returns empty path if index
+    // directory is not set or input file path can not be resolved
+    //
+    if(index_dir.empty()) {
+      return "";
+    }
+
+    char buf[PATH_MAX];
+
+    if(!realpath(fpath.c_str(), buf)) {
+      return "";
+    }
+
+    const std::string rpath(buf);
+
+    return index_dir + rpath.substr(0, rpath.find_last_of('/')+1) + name;
+  }
+
+  //==============================================================================
+  inline bool MakeSidecarDir(const std::string &spath)
+  {
+    //
+    // Create all parent directories of index file
+    //
+    for(size_t ipos = spath.find('/', 1); ipos != std::string::npos; ipos = spath.find('/', ipos+1)) {
+      const std::string dir = spath.substr(0, ipos);
+
+      if(mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST) {
+	return false;
+      }
+    }
+
+    return true;
+  }
+
+  //==============================================================================
+  inline bool IsSidecarField(const std::string &field)
+  {
+    return !field.empty() && field.find_first_of("\t\n") == std::string::npos;
+  }
+
+  //==============================================================================
+  inline void SplitSidecarLine(const std::string &line, std::vector<std::string> &fields)
+  {
+    fields.clear();
+
+    std::string::size_type ipos = 0;
+
+    while(true) {
+      const std::string::size_type jpos = line.find('\t', ipos);
+
+      fields.push_back(line.substr(ipos, jpos == std::string::npos ? std::string::npos : jpos-ipos));
+
+      if(jpos == std::string::npos) {
+	break;
+      }
+
+      ipos = jpos+1;
+    }
+  }
+
+  //==============================================================================
+  template<class T> inline bool ReadSidecarField(const std::string &field, T &value)
+  {
+    std::stringstream str(field);
+    return (str >> value) && str.eof();
+  }
+
+  //==============================================================================
+  inline SidecarLock::SidecarLock(const std::string &spath)
+    :fFd(-1)
+  {
+    const std::string lpath = spath + ".lock";
+
+    fFd = open(lpath.c_str(), O_RDWR | O_CREAT, 0644);
+
+    if(fFd >= 0 && flock(fFd, LOCK_EX) != 0) {
+      close(fFd);
+      fFd = -1;
+    }
+  }
+
+  //==============================================================================
+  inline SidecarLock::~SidecarLock()
+  {
+    if(fFd >= 0) {
+      flock(fFd, LOCK_UN);
+      close(fFd);
+    }
+  }
+}
+
+#endif
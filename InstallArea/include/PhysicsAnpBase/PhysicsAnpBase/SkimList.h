@@ -0,0 +1,394 @@
+// -*- c++ -*-
+#ifndef ANP_SKIMLIST_H
+#define ANP_SKIMLIST_H
+
+/**********************************************************************************
+ * @Package: PhysicsAnpBase
+ * @Class  : SkimList
+ * @Author : Rustem Ospanov
+ *
+ * @Brief  : Entry lists of events passing cut-flows and replay of these entries
+ *
+ *  Writing: ReadLoop sets current input file and entry and records entries
+ *  which pass cuts of each skim (Skims key). Lists are saved as sidecar text
+ *  file next to output ROOT file ("out.root" -> "out.skim"):
+ *
+ *    <skim name> <file path> <tree name> <number of entries> <first>-<last> ...
+ *
+ *  Each <first>-<last> is range of consecutive entries [first, last).
+ *
+ *  Replay: Load() reads entry lists of one skim and SelectEntries() returns
+ *  sorted entry ranges for one input file, so that entries are read in basket
+ *  order. Files without listed entries are skipped.
+ *
+ *  Write()/Read() copy recorded entries to/from text stream: used by ReadLoop
+ *  checkpoints, so that resumed job keeps entries recorded before checkpoint.
+ *
+ *  MergeFiles() concatenates sidecars of partial outputs of parallel event loops:
+ *  partial sidecars are removed only after merged file is written.
+ *
+ **********************************************************************************/
+
+// C/C++
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Base
+#include "PhysicsAnpBase/EventChunk.h"
+
+namespace Anp
+{
+  class SkimList
+  {
+  public:
+
+    SkimList() :fEntry(-1), fNRecord(0), fLoaded(false) {}
+    ~SkimList() {}
+
+    //
+    // Record entries
+    //
+    void SetInput(const std::string &fpath, const std::string &tree_name);
+
+    void SetEntry(long entry) { fEntry = entry; }
+
+    void Record(const std::string &skim);
+
+    bool Save(const std::string &path) const;
+
+    void Write(std::ostream &os) const;
+
+    void Read(std::istream &is);
+
+    bool HasRecords() const { return fNRecord > 0; }
+
+    //
+    // Replay entries
+    //
+    bool Load(const std::string &path, const std::string &skim = "");
+
+    bool IsLoaded() const { return fLoaded; }
+
+    void SelectEntries(const std::string &fpath, const std::string &tree_name, ChunkVec &chunks) const;
+
+    void Print(std::ostream &os = std::cout) const;
+
+    static std::string GetSidecarPath(const std::string &output_file);
+
+    static bool MergeFiles(const std::vector<std::string> &inputs, const std::string &output);
+
+  private:
+
+    typedef std::vector<long>                      EntryVec;
+    typedef std::map<std::string, EntryVec>        EntryMap;   // key: file path + tree name
+    typedef std::map<std::string, EntryMap>        SkimMap;    // key: skim name
+
+    typedef std::pair<long, long>                  Range;
+    typedef std::map<std::string, std::vector<Range> > RangeMap;  // key: file path + tree name
+
+  private:
+
+    static std::string GetKey(const std::string &fpath, const std::string &tree_name) { return fpath + " " + tree_name; }
+
+  private:
+
+    std::string     fKey;          // Key of current input file and tree
+    long            fEntry;        // Current entry
+    long            fNRecord;      // Number of recorded entries
+
+    SkimMap         fSkims;        // Recorded entries
+    RangeMap        fReplay;       // Loaded entry ranges
+    bool            fLoaded;
+  };
+
+  //==============================================================================
+  // Inlined functions
+  //==============================================================================
+  inline std::string SkimList::GetSidecarPath(const std::string &output_file)
+  {
+    std::string stem = output_file;
+
+    if(stem.size() > 5 && stem.substr(stem.size()-5) == ".root") {
+      stem = stem.substr(0, stem.size()-5);
+    }
+
+    return stem + ".skim";
+  }
+
+  //==============================================================================
+  inline void SkimList::SetInput(const std::string &fpath, const std::string &tree_name)
+  {
+    fKey   = GetKey(fpath, tree_name);
+    fEntry = -1;
+  }
+
+  //==============================================================================
+  inline void SkimList::Record(const std::string &skim)
+  {
+    if(fEntry < 0 || fKey.empty()) {
+      return;
+    }
+
+    EntryVec &entries = fSkims[skim][fKey];
+
+    //
+    // Several objects of same event may pass same cut-flow: record entry once
+    //
+    if(entries.empty() || entries.back() != fEntry) {
+      entries.push_back(fEntry);
+      ++fNRecord;
+    }
+  }
+
+  //==============================================================================
+  inline bool SkimList::Save(const std::string &path) const
+  {
+    std::ofstream outfile(path.c_str());
+
+    if(!outfile) {
+      std::cerr << "SkimList::Save - can not write: " << path << std::endl;
+      return false;
+    }
+
+    Write(outfile);
+
+    return bool(outfile);
+  }
+
+  //==============================================================================
+  inline void SkimList::Write(std::ostream &os) const
+  {
+    os << "# skim file tree entries first-last ..." << std::endl;
+
+    for(const SkimMap::value_type &s: fSkims) {
+      for(const EntryMap::value_type &e: s.second) {
+	EntryVec entries(e.second);
+
+	std::sort(entries.begin(), entries.end());
+	entries.erase(std::unique(entries.begin(), entries.end()), entries.end());
+
+	os << s.first << " " << e.first << " " << entries.size();
+
+	for(unsigned i = 0; i < entries.size(); ) {
+	  unsigned j = i+1;
+
+	  while(j < entries.size() && entries.at(j) == entries.at(j-1)+1) {
+	    ++j;
+	  }
+
+	  os << " " << entries.at(i) << "-" << entries.at(j-1)+1;
+	  i = j;
+	}
+
+	os << std::endl;
+      }
+    }
+  }
+
+  //==============================================================================
+  inline void SkimList::Read(std::istream &is)
+  {
+    //
+    // Add entries written by Write() to recorded entries
+    //
+    std::string line;
+
+    while(std::getline(is, line)) {
+      if(line.empty() || line.at(0) == '#') {
+	continue;
+      }
+
+      std::stringstream str(line);
+      std::string name, fpath, tree_name, range;
+      long nentry = 0;
+
+      if(!(str >> name >> fpath >> tree_name >> nentry)) {
+	continue;
+      }
+
+      EntryVec &entries = fSkims[name][GetKey(fpath, tree_name)];
+
+      while(str >> range) {
+	long first = 0, last = 0;
+
+	if(std::sscanf(range.c_str(), "%ld-%ld", &first, &last) != 2) {
+	  continue;
+	}
+
+	for(long entry = first; entry < last; ++entry) {
+	  entries.push_back(entry);
+	  ++fNRecord;
+	}
+      }
+    }
+  }
+
+  //==============================================================================
+  inline bool SkimList::Load(const std::string &path, const std::string &skim)
+  {
+    std::ifstream infile(path.c_str());
+
+    if(!infile) {
+      std::cerr << "SkimList::Load - can not read: " << path << std::endl;
+      return false;
+    }
+
+    std::string line;
+
+    while(std::getline(infile, line)) {
+      if(line.empty() || line.at(0) == '#') {
+	continue;
+      }
+
+      std::stringstream str(line);
+      std::string name, fpath, tree_name, range;
+      long nentry = 0;
+
+      if(!(str >> name >> fpath >> tree_name >> nentry)) {
+	continue;
+      }
+
+      if(!skim.empty() && name != skim) {
+	continue;
+      }
+
+      std::vector<Range> &ranges = fReplay[GetKey(fpath, tree_name)];
+
+      while(str >> range) {
+	long first = 0, last = 0;
+
+	if(std::sscanf(range.c_str(), "%ld-%ld", &first, &last) == 2 && first < last) {
+	  ranges.push_back(Range(first, last));
+	}
+      }
+    }
+
+    //
+    // Sort and merge ranges from several skims or partial outputs
+    //
+    for(RangeMap::value_type &r: fReplay) {
+      std::vector<Range> &ranges = r.second;
+      std::sort(ranges.begin(), ranges.end());
+
+      std::vector<Range> merged;
+
+      for(const Range &range: ranges) {
+	if(!merged.empty() && range.first <= merged.back().second) {
+	  merged.back().second = std::max<long>(merged.back().second, range.second);
+	}
+	else {
+	  merged.push_back(range);
+	}
+      }
+
+      ranges.swap(merged);
+    }
+
+    fLoaded = true;
+    return true;
+  }
+
+  //==============================================================================
+  inline void SkimList::SelectEntries(const std::string &fpath, const std::string &tree_name, ChunkVec &chunks) const
+  {
+    chunks.clear();
+
+    RangeMap::const_iterator rit = fReplay.find(GetKey(fpath, tree_name));
+
+    if(rit == fReplay.end()) {
+      return;
+    }
+
+    for(const Range &range: rit->second) {
+      EventChunk chunk;
+      chunk.file_path   = fpath;
+      chunk.tree_name   = tree_name;
+      chunk.first_entry = range.first;
+      chunk.last_entry  = range.second;
+
+      chunks.push_back(chunk);
+    }
+  }
+
+  //==============================================================================
+  inline bool SkimList::MergeFiles(const std::vector<std::string> &inputs, const std::string &output)
+  {
+    std::vector<std::string> paths;
+
+    for(const std::string &input: inputs) {
+      if(std::ifstream(input.c_str())) {
+	paths.push_back(input);
+      }
+    }
+
+    if(paths.empty()) {
+      return false;
+    }
+
+    std::ofstream outfile(output.c_str());
+
+    if(!outfile) {
+      std::cerr << "SkimList::MergeFiles - can not write: " << output << std::endl;
+      return false;
+    }
+
+    outfile << "# skim file tree entries first-last ..." << std::endl;
+
+    for(const std::string &path: paths) {
+      std::ifstream infile(path.c_str());
+      std::string   line;
+
+      while(std::getline(infile, line)) {
+	if(!line.empty() && line.at(0) != '#') {
+	  outfile << line << std::endl;
+	}
+      }
+
+      if(infile.bad()) {
+	std::cerr << "SkimList::MergeFiles - failed to read: " << path << std::endl;
+	return false;
+      }
+    }
+
+    outfile.close();
+
+    if(!outfile) {
+      std::cerr << "SkimList::MergeFiles - failed to write: " << output << std::endl;
+      return false;
+    }
+
+    for(const std::string &path: paths) {
+      std::remove(path.c_str());
+    }
+
+    return true;
+  }
+
+  //==============================================================================
+  inline void SkimList::Print(std::ostream &os) const
+  {
+    if(fNRecord > 0) {
+      os << "SkimList::Print - recorded " << fNRecord << " entries for " << fSkims.size() << " skim(s)" << std::endl;
+    }
+
+    if(fLoaded) {
+      long nentry = 0;
+
+      for(const RangeMap::value_type &r: fReplay) {
+	for(const Range &range: r.second) {
+	  nentry += range.second - range.first;
+	}
+      }
+
+      os << "SkimList::Print - replay " << nentry << " entries from " << fReplay.size() << " file(s)" << std::endl;
+    }
+  }
+}
+
+#endif
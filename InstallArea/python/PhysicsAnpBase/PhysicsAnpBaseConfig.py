@@ -76,6 +76,77 @@ def getRegistry():
 
     return ROOT.Anp.Registry()
 
+#========================================================================================================
+def getAnpClass(name, package='PhysicsAnpBase'):
+
+    '''
+    Return header-only C++ class Anp::<name>: if dictionary library was built before class was
+    added to selection.xml, class is declared to interpreter from its header
+    '''
+
+    import ROOT
+
+    if not hasattr(ROOT.Anp, name):
+        clog.info('getAnpClass - declare Anp::%s from %s/%s.h' %(name, package, name))
+        ROOT.gInterpreter.Declare('#include "%s/%s.h"' %(package, name))
+
+    return getattr(ROOT.Anp, name)
+
+#========================================================================================================
+def setParallelUnzip(enable=True):
+
+    '''
+    Select TTreeCacheUnzip for tree caches created after this call: returns previous setting
+    '''
+
+    import ROOT
+
+    prev = ROOT.TTreeCacheUnzip.IsParallelUnzip()
+
+    if enable:
+        ROOT.TTreeCacheUnzip.SetParallelUnzip(ROOT.TTreeCacheUnzip.kEnable)
+    else:
+        ROOT.TTreeCacheUnzip.SetParallelUnzip(ROOT.TTreeCacheUnzip.kDisable)
+
+    return prev
+
+#========================================================================================================
+def setTreeCacheDefaults(size=None, learn_entries=None, prefetch=False, unzip=False):
+
+    '''
+    Set ROOT defaults for automatic TTreeCache of prebuilt ReadNtuple loop and return previous values:
+    size=0 disables automatic cache, other sizes keep ROOT automatic size since TTreeCache.Size
+    is scale factor of ROOT estimate and not bytes - exact size is applied only by ReadLoop
+    '''
+
+    import ROOT
+
+    prev = {'size':          ROOT.gEnv.GetValue('TTreeCache.Size', 1.0),
+            'learn_entries': ROOT.TTreeCache.GetLearnEntries(),
+            'prefetch':      ROOT.gEnv.GetValue('TFile.AsyncPrefetching', 0),
+            'unzip':         ROOT.TTreeCacheUnzip.IsParallelUnzip()}
+
+    if size == 0:
+        ROOT.gEnv.SetValue('TTreeCache.Size', 0.0)
+    if learn_entries != None:
+        ROOT.TTreeCache.SetLearnEntries(learn_entries)
+    if prefetch:
+        ROOT.gEnv.SetValue('TFile.AsyncPrefetching', 1)
+    if unzip:
+        setParallelUnzip(True)
+
+    return prev
+
+#========================================================================================================
+def restoreTreeCacheDefaults(prev):
+
+    import ROOT
+
+    ROOT.gEnv.SetValue('TTreeCache.Size',         prev['size'])
+    ROOT.gEnv.SetValue('TFile.AsyncPrefetching',  prev['prefetch'])
+    ROOT.TTreeCache.SetLearnEntries(prev['learn_entries'])
+    setParallelUnzip(prev['unzip'])
+
 #========================================================================================================
 class AlgConfig:
     """AlgConfig - python configurable for C++ Anp::AlgEvent class"""
@@ -225,6 +296,21 @@ class AlgConfig:
         
         self._keys[key.GetKeyName()] = key
 
+    def DeclareInputs(self, vars=[], prefixes=[]):
+        #
+        # Input branches read by this algorithm: other branches are not read with PruneBranches=yes
+        #
+        if len(vars):
+            self.SetKey('InputVars', ','.join(vars))
+        if len(prefixes):
+            self.SetKey('InputPrefixes', ','.join(prefixes))
+
+    def SetCheckpointSafe(self, safe=True):
+        #
+        # Algorithm keeps its state only in histograms of output file: required by ReadNtuple.SetCheckpoint()
+        #
+        self.SetKey('CheckpointSafe', safe)
+
 #========================================================================================================
 class ReadNtuple:
     """ReadNtuple - python configuration for ReadNtuple to read input files and run algorithms
@@ -245,6 +331,8 @@ class ReadNtuple:
         self._hist  = getRegistry()
         self._hist.AllowNonUniqueKeys()
         self._gpar  = {}
+        self._skims = []
+        self._cache = {}
 
         self.SetPar('AlgName', alg_name)
         self.SetPar('AlgType', 'ReadNtuple')
@@ -298,6 +386,116 @@ class ReadNtuple:
     def AddHistFile(self, hfile):
         self._hist.Set('ReadFile', hfile)
 
+    def SetTreeCache(self, size=None, learn_entries=None, prefetch=False):
+        #
+        # TTreeCache of input trees: size in bytes is exact only for ReadLoop, see setTreeCacheDefaults()
+        #
+        if size != None:
+            self._cache['size'] = size
+            self.SetKey('CacheSize', size)
+        if learn_entries != None:
+            self._cache['learn_entries'] = learn_entries
+            self.SetKey('CacheLearnEntries', learn_entries)
+
+        self._cache['prefetch'] = prefetch
+        self.SetKey('CachePrefetch', prefetch)
+
+    def SetReadAhead(self, enable=True):
+        #
+        # Unzip baskets of input tree cache in ROOT thread: objects are still filled by main thread
+        #
+        self._cache['unzip'] = enable
+        self.SetKey('CacheUnzip', enable)
+
+    def SetNProcs(self, nprocs):
+        #
+        # Run event loop with nprocs forked ReadNtuple processes: outputs are merged by parent
+        #
+        self.SetKey('NProcs', nprocs)
+
+    def SetPrefilter(self, cuts):
+        #
+        # Two phase read: list branches are read only for events passing cuts on event variables
+        #
+        addCutsToRegistry(self._reg, 'Prefilter', cuts)
+        self.SetKey('TwoPhaseRead', 'yes')
+
+    def SetEventCache(self, alg, npass=1, memory_mb=512, spill_dir=None, cuts=None, output=None, min_free_mb=1024):
+        #
+        # Keep selected events in compressed cache and replay them npass times with algorithm alg after job
+        # algorithms are finalized - alg writes its own output file, default is output file with _replay suffix
+        #
+        if alg == None:
+            self._log.warning('SetEventCache - missing replay algorithm: events are not cached')
+            return
+
+        self.SetKey('EventCache',          'yes')
+        self.SetKey('EventCacheAlg',       alg.GetConfigRegistry())
+        self.SetKey('EventCachePasses',    npass)
+        self.SetKey('EventCacheMB',        memory_mb)
+        self.SetKey('EventCacheMinFreeMB', min_free_mb)
+
+        if spill_dir:
+            self.SetKey('EventCacheSpillDir', spill_dir)
+
+        if output:
+            self.SetKey('EventCacheOutputFile', output)
+
+        if cuts:
+            addCutsToRegistry(self._reg, 'EventCache', cuts)
+
+    def SetCheckpoint(self, path, nevent=0, seconds=600, resume=False, safe_algs=[]):
+        #
+        # Periodically save event loop position, histograms and cut counts of single process job - resume=True continues from saved position
+        # Every algorithm must keep its state only in histograms: AlgConfig.SetCheckpointSafe() or its type in safe_algs
+        #
+        self.SetKey('Checkpoint',       path)
+        self.SetKey('CheckpointNEvent', nevent)
+        self.SetKey('CheckpointSec',    seconds)
+        self.SetKey('Resume',           resume)
+
+        if len(safe_algs):
+            self.SetKey('CheckpointSafeAlgs', ','.join(safe_algs))
+
+    def SetBranchStats(self, text_path=None, nprint=30):
+        #
+        # Collect per-branch I/O statistics: written to output file and printed at end of job
+        #
+        self.SetKey('BranchStats',       'yes')
+        self.SetKey('BranchStatsNPrint', nprint)
+
+        if text_path:
+            self.SetKey('BranchStatsText', text_path)
+
+    def SetFileStage(self, stage_dir, size_mb=0, prefixes=None, prefetch=True):
+        #
+        # Copy input files into local cache directory (LRU eviction above size_mb) and prefetch next file
+        #
+        self.SetKey('StageDir',      stage_dir)
+        self.SetKey('StageMB',       float(size_mb))
+        self.SetKey('StagePrefetch', prefetch)
+
+        if prefixes:
+            self.SetKey('StagePrefixes', prefixes)
+
+    def AddSkim(self, name, cuts):
+        #
+        # Record entries of events passing cuts on event variables in SkimList file next to output file
+        #
+        addCutsToRegistry(self._reg, 'Skim%s' %name, cuts)
+
+        self._skims += [name]
+        self.SetKey('Skims', ','.join(self._skims))
+
+    def SetReplaySkim(self, path, skim=None):
+        #
+        # Read only entries listed in SkimList file written by previous job
+        #
+        self.SetKey('ReplaySkim', path)
+
+        if skim:
+            self.SetKey('ReplaySkimName', skim)
+
     def StoreInputFile(self, f):
         self._log.debug('StoreInputFile: %s' %f)
         self._files += [f]
@@ -334,7 +532,24 @@ class ReadNtuple:
         self._run.Execute(reg_path)
 
     def ExecuteRegistry(self):
-        self._run.ExecuteRegistry(self.GetRegistryConfig())
+        #
+        # ReadProcs is used only for NProcs > 1 or options of chunk loop (ReadLoop)
+        #
+        reg   = self.GetRegistryConfig()
+        procs = getAnpClass('ReadProcs')
+
+        if procs.IsNeeded(reg):
+            procs().ExecuteRegistry(reg)
+            return
+
+        #
+        # Prebuilt ReadNtuple loop: ROOT creates tree cache when first entry is read
+        #
+        prev = setTreeCacheDefaults(**self._cache)
+
+        self._run.ExecuteRegistry(reg)
+
+        restoreTreeCacheDefaults(prev)
 
 #========================================================================================================
 class RunModule:
@@ -350,6 +565,7 @@ class RunModule:
         self._alg   = None
         self._reg   = getRegistry()
         self._run   = ROOT.Anp.RunModule()
+        self._watch = None
         self._files = []
         self._dirs  = []        
         self._log   = getLog('RunModule')        
@@ -407,6 +623,22 @@ class RunModule:
     def AddHistFile(self, hfile):
         self._hist.Set('ReadFile', hfile)
 
+    def SetWatchDir(self, path, snapshot_sec=300, idle_sec=0, ledger=None, stop_file=None, suffix='.root', snapshot_file=None):
+        #
+        # Process new files in "path" as they appear and write snapshots of output histograms into separate file
+        #
+        self.SetKey('WatchDir',         path)
+        self.SetKey('WatchSuffix',      suffix)
+        self.SetKey('WatchSnapshotSec', snapshot_sec)
+        self.SetKey('WatchIdleSec',     idle_sec)
+
+        if ledger:
+            self.SetKey('WatchLedger', ledger)
+        if stop_file:
+            self.SetKey('WatchStopFile', stop_file)
+        if snapshot_file:
+            self.SetKey('WatchSnapshotFile', snapshot_file)
+
     def StoreInputFile(self, file):
         self._log.debug('StoreInputFile: '+file)
         self._files += [file]
@@ -466,15 +698,25 @@ class RunModule:
     #
     def Config(self, reg = None):
         if reg == None:
-            self._run.Config(self.GetRegistryConfig())
-        else:
-            self._run.Config(reg)
+            reg = self.GetRegistryConfig()
+
+        self._run.Config(reg)
+
+        #
+        # WatchDir: RunWatch reads new files of watched directory with RunModule - other jobs never load it
+        #
+        if reg.KeyExists('WatchDir'):
+            self._watch = getAnpClass('RunWatch')()
+            self._watch.Config(reg)
 
     def Init(self):
         self._run.Init()
 
     def Exec(self):
-        self._run.Exec()
+        if self._watch:
+            self._watch.Exec(self._run)
+        else:
+            self._run.Exec()
 
     def Execute(self, reg_path):
         self._run.Execute(reg_path)
@@ -482,6 +724,9 @@ class RunModule:
     def Done(self):
         self._run.Done()
 
+        if self._watch:
+            self._watch.Done()
+
     def AddInputFile(self, file):
         self._run.AddInputFile(file)
 
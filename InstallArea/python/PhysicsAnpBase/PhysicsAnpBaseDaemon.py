@@ -0,0 +1,194 @@
+
+import json
+import os
+import shlex
+import signal
+import sys
+import time
+import traceback
+
+from PhysicsAnpBase.PhysicsAnpBaseConfig import getLog
+
+#========================================================================================================
+clog = getLog(os.path.basename(__file__))
+
+#========================================================================================================
+class JobDaemon:
+
+    """
+    Long-lived local job server which keeps libraries, histogram XML and geometry resident:
+
+      - warmup(ROOT, options) is called once: load libraries, read HistMan XML files,
+        read geometry - everything which is expensive and identical for all jobs
+      - jobs are JSON files dropped into <spool>/new/ (write to hidden file and rename):
+          {"files": [...], "output": "out.root", "args": "--nevent 1000", "keys": {"NPrint": 100}}
+        "args" are parsed with the daemon option parser on top of daemon command line options
+      - jobs run back to back: each job runs in a child forked from warm parent, so that
+        job starts with resident configuration and leaves no state behind for next job
+      - job file is moved to <spool>/run/, then to <spool>/done/ or <spool>/failed/
+        and job stdout/stderr are written to <spool>/log/<job>.log
+      - daemon stops when <spool>/stop file appears or after idle_sec without jobs
+    """
+
+    def __init__(self, spool, parser, base_args, build, warmup=None, idle_sec=0, poll_sec=1.0):
+
+        self.spool     = spool.rstrip('/')
+        self.parser    = parser
+        self.base_args = base_args
+        self.build     = build
+        self.warmup    = warmup
+        self.idle_sec  = idle_sec
+        self.poll_sec  = poll_sec
+        self.njob      = 0
+        self.nfail     = 0
+
+        for sub in ['new', 'run', 'done', 'failed', 'log']:
+            path = self.GetDir(sub)
+            if not os.path.isdir(path):
+                os.makedirs(path)
+
+    def GetDir(self, sub):
+        return '%s/%s' %(self.spool, sub)
+
+    def Run(self, ROOT):
+
+        (options, args) = self.parser.parse_args(self.base_args)
+
+        if self.warmup:
+            timer = time.time()
+            self.warmup(ROOT, options)
+            clog.info('Run - warmup done in %.1f s' %(time.time() - timer))
+
+        #
+        # Jobs left in run/ by killed daemon are failed: they may have partial output
+        #
+        for job in sorted(os.listdir(self.GetDir('run'))):
+            self.MoveJob(job, 'run', 'failed')
+
+        clog.info('Run - waiting for jobs in: %s' %self.GetDir('new'))
+
+        last_job = time.time()
+
+        while not os.path.exists(self.GetDir('stop')):
+            jobs = self.GetNewJobs()
+
+            if not jobs:
+                if self.idle_sec > 0 and time.time() - last_job > self.idle_sec:
+                    clog.info('Run - idle for %d s: stop' %self.idle_sec)
+                    break
+
+                time.sleep(self.poll_sec)
+                continue
+
+            for job in jobs:
+                self.RunJob(job)
+
+            last_job = time.time()
+
+        clog.info('Run - processed %d job(s), %d failed' %(self.njob, self.nfail))
+
+    def GetNewJobs(self):
+        return sorted([f for f in os.listdir(self.GetDir('new')) if f.endswith('.json') and not f.startswith('.')])
+
+    def MoveJob(self, job, src, dst):
+        os.rename('%s/%s' %(self.GetDir(src), job), '%s/%s' %(self.GetDir(dst), job))
+
+    def RunJob(self, job):
+
+        self.MoveJob(job, 'new', 'run')
+        self.njob += 1
+
+        timer = time.time()
+        path  = '%s/%s' %(self.GetDir('run'), job)
+
+        try:
+            with open(path) as jfile:
+                conf = json.load(jfile)
+        except (IOError, ValueError) as err:
+            clog.error('RunJob - invalid job file %s: %s' %(job, err))
+            self.MoveJob(job, 'run', 'failed')
+            self.nfail += 1
+            return
+
+        sys.stdout.flush()
+        sys.stderr.flush()
+
+        pid = os.fork()
+
+        if pid == 0:
+            os._exit(self.RunChild(job, conf))
+
+        (pid, status) = os.waitpid(pid, 0)
+
+        if os.WIFEXITED(status) and os.WEXITSTATUS(status) == 0:
+            self.MoveJob(job, 'run', 'done')
+            clog.info('RunJob - %s done in %.1f s' %(job, time.time() - timer))
+        else:
+            self.MoveJob(job, 'run', 'failed')
+            self.nfail += 1
+            clog.error('RunJob - %s failed with status %d after %.1f s' %(job, status, time.time() - timer))
+
+    def RunChild(self, job, conf):
+
+        #
+        # Child: default signal handlers, job output goes to its own log file
+        #
+        signal.signal(signal.SIGINT,  signal.SIG_DFL)
+        signal.signal(signal.SIGTERM, signal.SIG_DFL)
+
+        log = os.open('%s/%s.log' %(self.GetDir('log'), job[:-len('.json')]), os.O_WRONLY | os.O_CREAT | os.O_TRUNC, 0644)
+        os.dup2(log, 1)
+        os.dup2(log, 2)
+        os.close(log)
+
+        try:
+            import ROOT
+
+            args = self.base_args + shlex.split(str(conf.get('args', '')))
+
+            if conf.get('output'):
+                args += ['--output', str(conf['output'])]
+
+            (options, pargs) = self.parser.parse_args(args)
+
+            files = [str(f) for f in conf.get('files', [])] + pargs
+
+            run = self.build(ROOT, options, files)
+
+            for key, value in conf.get('keys', {}).items():
+                if isinstance(value, basestring):
+                    value = str(value)
+
+                run.SetKey(str(key), value)
+
+            run.ExecuteRegistry()
+        except:
+            traceback.print_exc()
+            return 1
+        finally:
+            sys.stdout.flush()
+            sys.stderr.flush()
+
+        return 0
+
+#========================================================================================================
+def submitJob(spool, files, output, args='', keys=None, name=None):
+
+    """
+    Write job file into spool directory of running JobDaemon: file is renamed into
+    new/ after it is complete, so that daemon never reads partial job file
+    """
+
+    if name == None:
+        name = 'job_%d_%d' %(int(time.time()*1000), os.getpid())
+
+    conf = {'files': files, 'output': output, 'args': args, 'keys': keys or {}}
+
+    new_dir = '%s/new' %spool.rstrip('/')
+    tmp     = '%s/.%s.json' %(new_dir, name)
+
+    with open(tmp, 'w') as jfile:
+        json.dump(conf, jfile, indent=2)
+
+    os.rename(tmp, '%s/%s.json' %(new_dir, name))
+    return '%s/%s.json' %(new_dir, name)
@@ -3,6 +3,7 @@ import logging
 import os
 import re
 import sys
+import time
 
 import PhysicsAnpBase.PhysicsAnpBaseConfig as physicsBase
 import PhysicsAnpRPC .PhysicsAnpRPCUtils   as Utils
@@ -31,9 +32,39 @@ def prepareOptionParser():
 
     p.add_option('--nevent', '-n',      type='int',    default=0)
     p.add_option('--nprint',            type='int',    default=10000)
+    p.add_option('--nprocs',            type='int',    default=1)
+    p.add_option('--events-per-chunk',  type='int',    default=100000)
+    p.add_option('--chunk-mb',          type='float',  default=64.0)
+    p.add_option('--scan-threads',      type='int',    default=0)
+    p.add_option('--index-dir',         type='string', default=None)
+    p.add_option('--cache-size',        type='int',    default=None)
     p.add_option('--min-lb',            type='int',    default=None)
     p.add_option('--max-lb',            type='int',    default=None)
+    p.add_option('--prefilter',         type='string', default=None)
+    p.add_option('--write-skim',        type='string', default=None)
+    p.add_option('--replay-skim',       type='string', default=None)
+    p.add_option('--replay-skim-name',  type='string', default=None)
+    p.add_option('--event-frac-min',    type='float',  default=None)
+    p.add_option('--event-frac-max',    type='float',  default=None)
+    p.add_option('--cache-passes',      type='int',    default=0)
+    p.add_option('--cache-mb',          type='float',  default=512.0)
+    p.add_option('--cache-spill-dir',   type='string', default=None)
+    p.add_option('--cache-alg',         type='string', default=None)
+    p.add_option('--cache-free-mb',     type='float',  default=1024.0)
+    p.add_option('--checkpoint',        type='string', default=None)
+    p.add_option('--checkpoint-sec',    type='int',    default=600)
+    p.add_option('--checkpoint-nevent', type='int',    default=0)
+    p.add_option('--checkpoint-safe',   type='string', default=None)
+    p.add_option('--resume',            action='store_true', default=False)
     p.add_option('--lumi',              type='float',  default=20280.2)
+    p.add_option('--daemon-spool',      type='string', default=None)
+    p.add_option('--branch-stats-text', type='string', default=None)
+    p.add_option('--stage-dir',         type='string', default=None)
+    p.add_option('--stage-mb',          type='float',  default=50000.0)
+    p.add_option('--daemon-idle-sec',   type='int',    default=0)
+    p.add_option('--daemon-job',        type='string', default='paneleff')
+    p.add_option('--daemon-submit',     type='string', default=None)
+    p.add_option('--daemon-args',       type='string', default='')
 
     p.add_option('--batch', '-b',        action='store_true',  default=False, dest='batch')
     p.add_option('--debug', '-d',        action='store_true',  default=False, dest='debug')
@@ -52,6 +83,13 @@ def prepareOptionParser():
     p.add_option('--do-bme',             action='store_true',  default=False, dest='do_bme')
     p.add_option('--do-cosmic',          action='store_true',  default=False, dest='do_cosmic')
     p.add_option('--dry-run',            action='store_true',  default=False, dest='dryrun')
+    p.add_option('--prune-branches',     action='store_true',  default=False, dest='prune_branches')
+    p.add_option('--prune-scalars',      action='store_true',  default=False, dest='prune_scalars')
+    p.add_option('--cache-prefetch',     action='store_true',  default=False, dest='cache_prefetch')
+    p.add_option('--read-ahead',         action='store_true',  default=False, dest='read_ahead')
+    p.add_option('--no-entry-index',     action='store_true',  default=False, dest='no_entry_index')
+    p.add_option('--branch-stats',       action='store_true',  default=False, dest='branch_stats')
+    p.add_option('--event-frac-stratified', action='store_true', default=False, dest='event_frac_stratified')
     p.add_option('--draw',               action='store_true',  default=False, dest='draw')
     p.add_option('--write',              action='store_true',  default=False, dest='write')
 
@@ -77,6 +115,8 @@ def prepareOptionParser():
 clog = physicsBase.getLog(os.path.basename(__file__))
 
 load_libs = None
+hist_xml  = {}
+warm_geo  = []
 
 #========================================================================================================
 def loadPhysicsAnpRPCLibs(ROOT):
@@ -117,15 +157,72 @@ def prepareReadNtuple(ROOT, options, tree, hist_config=None):
     run.SetKey('Debug',          options.debug_run or options.debug_all)
     run.SetKey('FileKeys',       '.root')
     run.SetKey('CloseFile',      'yes')
+    run.SetKey('PruneBranches',  options.prune_branches)
+    run.SetKey('PruneScalars',   options.prune_scalars)
+    run.SetKey('UseEntryIndex',  not options.no_entry_index)
+    run.SetKey('ScanThreads',    options.scan_threads)
+
+    if options.cache_size != None or options.cache_prefetch:
+        run.SetTreeCache(size=options.cache_size*1024*1024 if options.cache_size != None else None,
+                         prefetch=options.cache_prefetch)
+    if options.index_dir != None:
+        run.SetKey('IndexDir', options.index_dir)
+
+    if options.min_lb:
+        run.SetKey('MinLB', options.min_lb)
+    if options.max_lb:
+        run.SetKey('MaxLB', options.max_lb)
+    if options.prefilter:
+        run.SetPrefilter([physicsBase.CutItem('Prefilter', options.prefilter)])
+    if options.event_frac_min != None or options.event_frac_max != None:
+        run.SetKey('EventFracMin',        options.event_frac_min if options.event_frac_min != None else 0.0)
+        run.SetKey('EventFracMax',        options.event_frac_max if options.event_frac_max != None else 1.0)
+        run.SetKey('EventFracStratified', options.event_frac_stratified)
+    if options.write_skim:
+        run.AddSkim('WriteSkim', [physicsBase.CutItem('WriteSkim', options.write_skim)])
+    if options.replay_skim:
+        run.SetReplaySkim(options.replay_skim, options.replay_skim_name)
+    if options.cache_passes > 0:
+        cache_alg = None
+        if options.cache_alg:
+            cache_alg = physicsBase.AlgConfig(options.cache_alg, options.cache_alg)
+
+        run.SetEventCache(cache_alg, options.cache_passes, options.cache_mb, options.cache_spill_dir, min_free_mb=options.cache_free_mb)
+    if options.checkpoint:
+        safe_algs = []
+        if options.checkpoint_safe:
+            safe_algs = options.checkpoint_safe.split(',')
+
+        run.SetCheckpoint(options.checkpoint, options.checkpoint_nevent, options.checkpoint_sec, options.resume, safe_algs)
+    if options.branch_stats:
+        run.SetBranchStats(options.branch_stats_text)
+    if options.stage_dir:
+        run.SetFileStage(options.stage_dir, options.stage_mb)
+    if options.read_ahead:
+        run.SetReadAhead()
+
     run.SetKey('Print',          'yes')
     run.SetPar('HistMan::Debug', 'no')
     run.SetPar('HistMan::Sumw2', 'yes')
+
+    if options.nprocs > 1:
+        run.SetKey('EventsPerChunk', options.events_per_chunk)
+        run.SetKey('ChunkMB',        options.chunk_mb)
+        run.SetNProcs(options.nprocs)
     
     if options.output:
         run.SetKey('OutputFile', options.output)
         
+    readHistConfig(ROOT, hist_config)
+
+    return run
+
+#========================================================================================================
+def readHistConfig(ROOT, hist_config):
+
     #
-    # Read histogram definitions
+    # Read histogram definitions: XML files already read by this process
+    # (or by JobDaemon parent before fork) are parsed again only if modified
     #
     histman  = ROOT.Anp.HistMan.Instance()
     histdirs = []
@@ -153,9 +250,78 @@ def prepareReadNtuple(ROOT, options, tree, hist_config=None):
         clog.info('prepareReadNtuple - read xml files from: %s' %hdir)                
         for f in os.listdir(hdir):
             if f.count('.xml'):
-                histman.ReadFile('%s/%s' %(hdir.rstrip('/'), f))
+                path  = '%s/%s' %(hdir.rstrip('/'), f)
+                mtime = os.path.getmtime(path)
 
-    return run
+                if hist_xml.get(path) == mtime:
+                    continue
+
+                histman.ReadFile(path)
+                hist_xml[path] = mtime
+
+#========================================================================================================
+def runJobDaemon(ROOT, options, parser, build, hist_config=None, warmup_geo=True):
+
+    '''
+    Serve jobs from spool directory (--daemon-spool): libraries, histogram XML files and
+    RPC geometry are loaded once, build(ROOT, options, files) returns ReadNtuple for each job
+    '''
+
+    import PhysicsAnpBase.PhysicsAnpBaseDaemon as daemon
+
+    def warmup(ROOT, warm_options):
+        loadPhysicsAnpRPCLibs(ROOT)
+        readHistConfig(ROOT, hist_config)
+
+        if warmup_geo:
+            warmupRpcGeo(ROOT, warm_options)
+
+    #
+    # Daemon options are not passed to jobs
+    #
+    base_args = []
+    skip_next = False
+
+    for arg in sys.argv[1:]:
+        if skip_next:
+            skip_next = False
+        elif arg.startswith('--daemon-'):
+            skip_next = arg.count('=') == 0
+        else:
+            base_args += [arg]
+
+    server = daemon.JobDaemon(options.daemon_spool, parser, base_args, build,
+                              warmup=warmup, idle_sec=options.daemon_idle_sec)
+    server.Run(ROOT)
+
+#========================================================================================================
+def warmupRpcGeo(ROOT, options):
+
+    '''
+    Initialize PrepRpcGeo once in daemon parent: geometry file is read into RpcGeoMan and
+    NtupleSvc, so that forked jobs start with geometry pages and dictionaries resident
+    '''
+
+    timer = time.time()
+
+    run = physicsBase.ReadNtuple('warmupRpcGeo')
+    run.SetKey('OutputFile', '')
+    run.SetKey('Print',      'no')
+    run.AddTopAlg('topAlg', [getPrepRpcGeo('prepRpcGeo', options, ROOT)])
+
+    geo_run = ROOT.Anp.ReadNtuple()
+    geo_run.Config(run.GetRegistryConfig())
+
+    if not geo_run.Init():
+        clog.warning('warmupRpcGeo - failed to initialize PrepRpcGeo')
+        return
+
+    #
+    # Algorithm is never finalized: RpcGeoMan is not cleared before fork
+    #
+    warm_geo.append(geo_run)
+
+    clog.info('warmupRpcGeo - read RPC geometry in %.1f s' %(time.time() - timer))
 
 #========================================================================================================
 def getCutValue(cuts, name, default):
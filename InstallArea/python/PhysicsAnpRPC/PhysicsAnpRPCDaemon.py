@@ -0,0 +1,78 @@
+'''
+Job daemon for RPC jobs: libraries, histogram XML files and RPC geometry are loaded once
+and jobs dropped into spool directory run back to back (see PhysicsAnpBaseDaemon.JobDaemon)
+
+Start daemon with the same options as interactive job, plus daemon options:
+
+  python -m PhysicsAnpRPC.PhysicsAnpRPCDaemon --daemon-spool=/tmp/rpc_spool --daemon-job=paneleff \\
+         --rpc-geo=rpc_geometry.root --daemon-idle-sec=3600
+
+Submit job:
+
+  python -m PhysicsAnpRPC.PhysicsAnpRPCDaemon --daemon-spool=/tmp/rpc_spool --daemon-submit=out.root \\
+         --daemon-args='-n 1000' input_1.root input_2.root
+
+Stop daemon: touch /tmp/rpc_spool/stop
+'''
+
+import os
+import sys
+
+import PhysicsAnpBase.PhysicsAnpBaseConfig as physicsBase
+import PhysicsAnpBase.PhysicsAnpBaseDaemon as daemon
+import PhysicsAnpRPC .PhysicsAnpRPCConfig  as config
+
+clog = physicsBase.getLog(os.path.basename(__file__))
+
+#========================================================================================================
+def getJobBuild(job):
+
+    '''
+    Return build(ROOT, options, files) function and histogram configuration of job type
+    '''
+
+    if job == 'paneleff':
+        import PhysicsAnpRPC.PhysicsAnpRPCPanelEff as panelEff
+        return (panelEff.prepareJobConfig, ['PhysicsAnpRPC/config/rpc-eff'])
+
+    if job == 'trigger':
+        import PhysicsAnpRPC.PhysicsAnpRPCTrigger as trigger
+        return (trigger.prepareJobConfig, ['PhysicsAnpRPC/config/rpc-eff'])
+
+    if job == 'noise':
+        import PhysicsAnpRPC.PhysicsAnpRPCNoise as noise
+        return (noise.prepareJobConfig, ['PhysicsAnpRPC/config/rpc-eff'])
+
+    raise Exception('getJobBuild - unknown job type: "%s"' %job)
+
+#========================================================================================================
+def main():
+
+    parser = config.prepareOptionParser()
+
+    (options, args) = parser.parse_args()
+
+    if not options.daemon_spool:
+        clog.error('main - missing --daemon-spool')
+        return 1
+
+    if options.daemon_submit:
+        #
+        # Daemon runs in its own working directory
+        #
+        files = [os.path.abspath(f) for f in args]
+        path  = daemon.submitJob(options.daemon_spool, files, os.path.abspath(options.daemon_submit), options.daemon_args)
+        clog.info('main - submitted job: %s' %path)
+        return 0
+
+    (build, hist_config) = getJobBuild(options.daemon_job)
+
+    import ROOT
+    ROOT.gROOT.SetBatch(True)
+
+    config.runJobDaemon(ROOT, options, parser, build, hist_config)
+    return 0
+
+#========================================================================================================
+if __name__ == '__main__':
+    sys.exit(main())
@@ -112,6 +112,8 @@ def getPrepRpcMuon(name, options):
     alg.SetKey('BmeNtupleInstance',  'bme')
     alg.SetKey('MissingGeoStripIds', 'miss_strip_ids.txt')
 
+    alg.DeclareInputs(prefixes=['m_muon_', 'm_rpc_hit_'])
+
     rpc_intime_cut   = [CutItem('CutHitTime',     'fabs([prdTime]) < 12.5')]
     rpc_residual_cut = [CutItem('CutHitResidual', 'fabs([HitResidual]) < 30.0')]
 
@@ -167,6 +169,8 @@ def getPlotRpcNoise(cand, key, options, do_strip_times=True, do_muon_veto=True):
     alg.SetKey('KeyRpcResult',     'RpcExtrapolationResultGeoCut')
     alg.SetKey('SelectCandName' ,   getAlgName(cand))
 
+    alg.DeclareInputs(prefixes=['m_rpc_hit_'])
+
     if options.small_noise_hists:
         alg.SetKey('DoLBTree',       'yes')
         alg.SetKey('PlotStrip2d',    'no')
@@ -180,6 +180,9 @@ def getPrepRpcMuon(name, options, do_raw_chan=False):
 
     if do_raw_chan:
         alg.SetKey('KeyRpcChans', 'm_rpc_rdo_')
+        alg.DeclareInputs(prefixes=['m_muon_', 'm_rpc_hit_', 'm_rpc_rdo_'])
+    else:
+        alg.DeclareInputs(prefixes=['m_muon_', 'm_rpc_hit_'])
 
     if options.do_extrID: alg.SetKey('KeyRpcExtrap', 'RpcExtrapolateID_')
     else:                 alg.SetKey('KeyRpcExtrap', 'RpcExtrapolate_')
@@ -262,6 +265,8 @@ def getPrepL1Muon(name, options):
     alg.SetKey('KeyL1MuonRoIInput',  'm_l1mu_ctpi_')
     alg.SetKey('KeyL1MuonRoIOutput', 'MatchedRoIs')
 
+    alg.DeclareInputs(prefixes=['m_l1mu_ctpi_'])
+
     addCuts(alg, 'CutRpcRoI',  [CutItem('CutRpcSource', '[source] == 0')])
 
     return alg
@@ -396,6 +401,7 @@ def getPlotFakeTrigCand(cand, key, options, thr, source):
     alg.SetKey('Print',            'yes')
     alg.SetKey('DirName' ,         '')
     alg.SetKey('KeyL1MuonRoIInput',  'm_l1mu_ctpi_')
+    alg.DeclareInputs(prefixes=['m_l1mu_ctpi_'])
     if source.count('Tgc'):
         alg.SetKey('DoBarrel',  'no')
     if thr.count('mu20M6'):
@@ -73,6 +73,8 @@ def getPrepL1Muon(name, options):
     alg.SetKey('KeyL1MuonRoIInput',  'm_l1mu_ctpi_')
     alg.SetKey('KeyL1MuonRoIOutput', 'MatchedRoIs')
 
+    alg.DeclareInputs(prefixes=['m_l1mu_ctpi_'])
+
     addCuts(alg, 'CutRpcRoI',  [CutItem('CutRpcSource', '[source] == 0')])
 
     return alg
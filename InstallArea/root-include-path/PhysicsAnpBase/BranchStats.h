@@ -0,0 +1,461 @@
+// -*- c++ -*-
+#ifndef ANP_BRANCHSTATS_H
+#define ANP_BRANCHSTATS_H
+
+/**********************************************************************************
+ * @Package: PhysicsAnpBase
+ * @Class  : BranchStats
+ * @Author : Rustem Ospanov
+ *
+ * @Brief  : Collect per-branch I/O statistics of input trees
+ *
+ *  Attach() installs TTreePerfStats for input tree: ROOT reports every basket
+ *  which is decompressed (UnzipEvent) with basket file position, compressed and
+ *  uncompressed size. Position is matched to branch using basket seek table of
+ *  active branches made by Attach().
+ *
+ *  Detach() adds per-file totals: disk read time, decompression time, bytes read
+ *  and TTreeCache efficiency: GetEfficiency() - fraction of bytes read from cache,
+ *  GetEfficiencyRel() - same for bytes which were prefetched. Print() shows mean
+ *  efficiency of files read with TTreeCache.
+ *
+ *  Branch cost is its decompression time plus share of disk read time equal to
+ *  its fraction of compressed bytes: Print() and Write() sort branches by cost.
+ *
+ *  Only decompressed baskets are seen: uncompressed baskets are not counted.
+ *  TTreePerfStats is global (gPerfStats): one BranchStats per process.
+ *
+ **********************************************************************************/
+
+// C/C++
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+// ROOT
+#include "TBranch.h"
+#include "TDirectory.h"
+#include "TFile.h"
+#include "TH1.h"
+#include "TTimeStamp.h"
+#include "TTree.h"
+#include "TTreeCache.h"
+#include "TTreePerfStats.h"
+
+// Base
+#include "PhysicsAnpBase/Registry.h"
+
+namespace Anp
+{
+  class BranchStats
+  {
+  public:
+
+    struct Stat
+    {
+      Stat() :zip_bytes(0), unzip_bytes(0), unzip_time(0.0), nbasket(0), cost(0.0) {}
+
+      std::string  name;
+      long long    zip_bytes;     // Compressed bytes of decompressed baskets
+      long long    unzip_bytes;   // Uncompressed bytes of decompressed baskets
+      double       unzip_time;    // Decompression time in seconds
+      long         nbasket;       // Number of decompressed baskets
+      double       cost;          // Decompression time plus share of disk time
+    };
+
+    typedef std::vector<Stat> StatVec;
+
+  public:
+
+    BranchStats();
+    ~BranchStats();
+
+    void Config(const Registry &reg);
+
+    void Attach(TTree *tree);
+
+    void Detach(TTree *tree, TFile *file);
+
+    bool IsEnabled() const { return fEnabled; }
+
+    StatVec GetSortedStats() const;
+
+    void Print(std::ostream &os = std::cout) const;
+
+    void Write(TDirectory *dir) const;
+
+    void SaveText() const;
+
+  private:
+
+    class PerfStats: public TTreePerfStats
+    {
+    public:
+
+      PerfStats(TTree *tree, BranchStats *owner) :TTreePerfStats("BranchStats", tree), fTree(tree), fOwner(owner) {}
+      virtual ~PerfStats() {}
+
+      virtual void UnzipEvent(TObject *tree, Long64_t pos, Double_t start, Int_t complen, Int_t objlen)
+      {
+	TTreePerfStats::UnzipEvent(tree, pos, start, complen, objlen);
+
+	if(tree == fTree) {
+	  fOwner->AddBasket(pos, TTimeStamp().AsDouble() - start, complen, objlen);
+	}
+      }
+
+    private:
+
+      TTree        *fTree;
+      BranchStats  *fOwner;
+    };
+
+    typedef std::map<std::string, Stat> StatMap;
+    typedef std::map<Long64_t, Stat *>  SeekMap;
+
+  private:
+
+    void AddBasket(Long64_t pos, double unzip_time, long complen, long objlen);
+
+    void AddBranch(TBranch *branch);
+
+  private:
+
+    BranchStats(const BranchStats &);
+    BranchStats& operator=(const BranchStats &);
+
+  private:
+
+    // Properties:
+    bool           fEnabled;       // Collect branch statistics
+    bool           fDebug;
+    std::string    fTextPath;      // Path for text summary: empty - print only
+    unsigned       fNPrint;        // Number of branches printed by Print()
+
+    // Variables:
+    PerfStats     *fPerf;          // TTreePerfStats of current input tree
+    StatMap        fStats;         // Statistics of all branches, keyed by branch name
+    SeekMap        fSeeks;         // Basket file position to branch of current tree
+
+    unsigned       fNFile;
+    long           fNReadCalls;    // File read calls
+    double         fBytesRead;     // Bytes read from input files
+    unsigned       fNCacheFile;    // Number of files read with TTreeCache
+    double         fCacheEff;      // Sum of TTreeCache::GetEfficiency() of files
+    double         fCacheEffRel;   // Sum of TTreeCache::GetEfficiencyRel() of files
+    double         fDiskTime;      // Time spent in file reads
+    double         fUnzipTime;     // Time spent in decompression
+    double         fRealTime;      // Wall time while input files were open
+    double         fCpuTime;       // CPU time while input files were open
+  };
+
+  //==============================================================================
+  // Inlined functions
+  //==============================================================================
+  inline BranchStats::BranchStats()
+    :fEnabled    (false),
+     fDebug      (false),
+     fNPrint     (30),
+     fPerf       (0),
+     fNFile      (0),
+     fNReadCalls (0),
+     fBytesRead  (0.0),
+     fNCacheFile (0),
+     fCacheEff   (0.0),
+     fCacheEffRel(0.0),
+     fDiskTime   (0.0),
+     fUnzipTime  (0.0),
+     fRealTime   (0.0),
+     fCpuTime    (0.0)
+  {
+  }
+
+  //==============================================================================
+  inline BranchStats::~BranchStats()
+  {
+    delete fPerf;
+  }
+
+  //==============================================================================
+  inline void BranchStats::Config(const Registry &reg)
+  {
+    reg.Get("Debug",             fDebug);
+    reg.Get("BranchStats",       fEnabled);
+    reg.Get("BranchStatsText",   fTextPath);
+    reg.Get("BranchStatsNPrint", fNPrint);
+  }
+
+  //==============================================================================
+  inline void BranchStats::Attach(TTree *tree)
+  {
+    delete fPerf;
+    fPerf = 0;
+    fSeeks.clear();
+
+    if(!fEnabled || !tree) {
+      return;
+    }
+
+    //
+    // Basket positions of active branches: disabled branches are never read
+    //
+    TObjArray *branches = tree->GetListOfBranches();
+
+    for(int i = 0; branches && i < branches->GetEntries(); ++i) {
+      TBranch *branch = dynamic_cast<TBranch *>(branches->At(i));
+
+      if(branch && tree->GetBranchStatus(branch->GetName())) {
+	AddBranch(branch);
+      }
+    }
+
+    fPerf = new PerfStats(tree, this);
+
+    if(fDebug) {
+      std::cout << "BranchStats::Attach - " << tree->GetName() << ": " << fSeeks.size() << " basket(s) of active branches" << std::endl;
+    }
+  }
+
+  //==============================================================================
+  inline void BranchStats::AddBranch(TBranch *branch)
+  {
+    Stat &stat = fStats[branch->GetName()];
+    stat.name  = branch->GetName();
+
+    for(int i = 0; i < branch->GetWriteBasket(); ++i) {
+      const Long64_t seek = branch->GetBasketSeek(i);
+
+      if(seek > 0) {
+	fSeeks[seek] = &stat;
+      }
+    }
+
+    //
+    // Sub-branches of split objects have their own baskets
+    //
+    TObjArray *subs = branch->GetListOfBranches();
+
+    for(int i = 0; subs && i < subs->GetEntries(); ++i) {
+      TBranch *sub = dynamic_cast<TBranch *>(subs->At(i));
+
+      if(sub) {
+	AddBranch(sub);
+      }
+    }
+  }
+
+  //==============================================================================
+  inline void BranchStats::AddBasket(Long64_t pos, double unzip_time, long complen, long objlen)
+  {
+    SeekMap::iterator sit = fSeeks.find(pos);
+
+    if(sit == fSeeks.end()) {
+      return;
+    }
+
+    Stat &stat = *(sit->second);
+
+    stat.zip_bytes   += complen;
+    stat.unzip_bytes += objlen;
+    stat.unzip_time  += unzip_time;
+    stat.nbasket++;
+  }
+
+  //==============================================================================
+  inline void BranchStats::Detach(TTree *tree, TFile *file)
+  {
+    //
+    // Collect file totals before input file is closed
+    //
+    if(!fPerf) {
+      return;
+    }
+
+    fPerf->Finish();
+
+    ++fNFile;
+    fDiskTime  += fPerf->GetDiskTime();
+    fUnzipTime += fPerf->GetUnzipTime();
+    fRealTime  += fPerf->GetRealTime();
+    fCpuTime   += fPerf->GetCpuTime();
+
+    if(file) {
+      fNReadCalls += file->GetReadCalls();
+      fBytesRead  += file->GetBytesRead();
+
+      TTreeCache *cache = file->GetCacheRead(tree);
+
+      if(cache) {
+	++fNCacheFile;
+	fCacheEff    += cache->GetEfficiency();
+	fCacheEffRel += cache->GetEfficiencyRel();
+      }
+    }
+
+    if(tree) {
+      tree->SetPerfStats(0);
+    }
+
+    delete fPerf;
+    fPerf = 0;
+    fSeeks.clear();
+  }
+
+  //==============================================================================
+  inline BranchStats::StatVec BranchStats::GetSortedStats() const
+  {
+    StatVec stats;
+    double  zip_all = 0.0;
+
+    for(const StatMap::value_type &s: fStats) {
+      if(s.second.nbasket > 0) {
+	stats.push_back(s.second);
+	zip_all += s.second.zip_bytes;
+      }
+    }
+
+    for(Stat &s: stats) {
+      s.cost = s.unzip_time + (zip_all > 0.0 ? fDiskTime*s.zip_bytes/zip_all : 0.0);
+    }
+
+    std::sort(stats.begin(), stats.end(), [](const Stat &lhs, const Stat &rhs) { return lhs.cost > rhs.cost; });
+
+    return stats;
+  }
+
+  //==============================================================================
+  inline void BranchStats::Print(std::ostream &os) const
+  {
+    if(!fEnabled || fNFile == 0) {
+      return;
+    }
+
+    const StatVec stats = GetSortedStats();
+    const double  iotime = fDiskTime + fUnzipTime;
+
+    const std::streamsize prec = os.precision();
+
+    os << "BranchStats::Print - " << fNFile << " file(s), " << stats.size() << " branch(es) read" << std::endl
+       << std::fixed << std::setprecision(1)
+       << "   MB read:          " << fBytesRead/1048576.0 << " in " << fNReadCalls << " read call(s)" << std::endl
+       << "   cache efficiency: " << std::setprecision(3) << (fNCacheFile > 0 ? fCacheEff   /fNCacheFile : 0.0)
+       << " (relative " << (fNCacheFile > 0 ? fCacheEffRel/fNCacheFile : 0.0) << ")" << std::endl
+       << "   disk time:        " << std::setprecision(1) << fDiskTime  << " s" << std::endl
+       << "   unzip time:       " << fUnzipTime << " s" << std::endl
+       << "   real/cpu time:    " << fRealTime  << "/" << fCpuTime << " s" << std::endl
+       << "   I/O fraction:     " << std::setprecision(3) << (fRealTime > 0.0 ? iotime/fRealTime : 0.0)
+       << (fRealTime > 0.0 && iotime > 0.5*fRealTime ? " - job is I/O bound" : " - job is CPU bound") << std::endl;
+
+    os << "   " << std::setw(40) << std::left << "branch" << std::right
+       << std::setw(12) << "zip MB" << std::setw(12) << "unzip MB" << std::setw(10) << "baskets"
+       << std::setw(12) << "unzip s" << std::setw(12) << "cost s" << std::endl;
+
+    for(unsigned i = 0; i < stats.size() && (fNPrint == 0 || i < fNPrint); ++i) {
+      const Stat &s = stats.at(i);
+
+      os << "   " << std::setw(40) << std::left << s.name << std::right << std::setprecision(3)
+	 << std::setw(12) << s.zip_bytes/1048576.0
+	 << std::setw(12) << s.unzip_bytes/1048576.0
+	 << std::setw(10) << s.nbasket
+	 << std::setw(12) << s.unzip_time
+	 << std::setw(12) << s.cost << std::endl;
+    }
+
+    os.unsetf(std::ios_base::floatfield);
+    os.precision(prec);
+  }
+
+  //==============================================================================
+  inline void BranchStats::Write(TDirectory *dir) const
+  {
+    //
+    // One histogram per quantity with branch names as bin labels, sorted by cost
+    //
+    if(!fEnabled || !dir || fNFile == 0) {
+      return;
+    }
+
+    const StatVec stats = GetSortedStats();
+
+    if(stats.empty()) {
+      return;
+    }
+
+    TDirectory *curr = gDirectory;
+    TDirectory *odir = dir->mkdir("BranchStats");
+
+    if(!odir) {
+      return;
+    }
+
+    odir->cd();
+
+    const int nbin = stats.size();
+
+    TH1D *h_zip   = new TH1D("zip_bytes",   "Compressed bytes read",  nbin, 0.0, nbin);
+    TH1D *h_unzip = new TH1D("unzip_bytes", "Uncompressed bytes read", nbin, 0.0, nbin);
+    TH1D *h_time  = new TH1D("unzip_time",  "Decompression time [s]",  nbin, 0.0, nbin);
+    TH1D *h_nbask = new TH1D("nbasket",     "Baskets read",            nbin, 0.0, nbin);
+    TH1D *h_cost  = new TH1D("cost",        "Decompression time plus disk time share [s]", nbin, 0.0, nbin);
+
+    for(int i = 0; i < nbin; ++i) {
+      const Stat &s = stats.at(i);
+
+      h_zip  ->SetBinContent(i+1, s.zip_bytes);
+      h_unzip->SetBinContent(i+1, s.unzip_bytes);
+      h_time ->SetBinContent(i+1, s.unzip_time);
+      h_nbask->SetBinContent(i+1, s.nbasket);
+      h_cost ->SetBinContent(i+1, s.cost);
+
+      h_zip  ->GetXaxis()->SetBinLabel(i+1, s.name.c_str());
+      h_unzip->GetXaxis()->SetBinLabel(i+1, s.name.c_str());
+      h_time ->GetXaxis()->SetBinLabel(i+1, s.name.c_str());
+      h_nbask->GetXaxis()->SetBinLabel(i+1, s.name.c_str());
+      h_cost ->GetXaxis()->SetBinLabel(i+1, s.name.c_str());
+    }
+
+    TH1D *h_job = new TH1D("job", "Job I/O totals", 10, 0.0, 10.0);
+
+    const char  *labels[10] = {"files", "read_calls", "bytes_read", "cache_files", "cache_eff_sum", "cache_eff_rel_sum",
+			       "disk_time", "unzip_time", "real_time", "cpu_time"};
+    const double values[10] = {double(fNFile), double(fNReadCalls), fBytesRead, double(fNCacheFile), fCacheEff, fCacheEffRel,
+			       fDiskTime, fUnzipTime, fRealTime, fCpuTime};
+
+    for(int i = 0; i < 10; ++i) {
+      h_job->SetBinContent(i+1, values[i]);
+      h_job->GetXaxis()->SetBinLabel(i+1, labels[i]);
+    }
+
+    if(curr) {
+      curr->cd();
+    }
+  }
+
+  //==============================================================================
+  inline void BranchStats::SaveText() const
+  {
+    if(!fEnabled || fTextPath.empty() || fNFile == 0) {
+      return;
+    }
+
+    std::ofstream outf(fTextPath.c_str());
+
+    if(!outf.is_open()) {
+      std::cerr << "BranchStats::SaveText - can not write: " << fTextPath << std::endl;
+      return;
+    }
+
+    outf << "# branch zip_bytes unzip_bytes nbasket unzip_time cost" << std::endl;
+
+    for(const Stat &s: GetSortedStats()) {
+      outf << s.name << " " << s.zip_bytes << " " << s.unzip_bytes << " " << s.nbasket
+	   << " " << s.unzip_time << " " << s.cost << std::endl;
+    }
+  }
+}
+
+#endif
@@ -0,0 +1,283 @@
+// -*- c++ -*-
+#ifndef ANP_BRANCHUSAGE_H
+#define ANP_BRANCHUSAGE_H
+
+/**********************************************************************************
+ * @Package: PhysicsAnpBase
+ * @Class  : BranchUsage
+ * @Author : Rustem Ospanov
+ *
+ * @Brief  : Singleton registry of input branches declared by algorithms
+ *
+ *  Input branches are declared by ReadLoop::DeclareUsage() from InputVars and
+ *  InputPrefixes keys of algorithm configurations (AlgConfig.DeclareInputs()):
+ *    - DeclareVar()     - exact branch name, e.g. "RunNumber"
+ *    - DeclarePrefix()  - all branches starting with prefix, e.g. "mu_"
+ *    - DeclareScalars() - all flat branches with one value per entry
+ *
+ *  PruneTree() disables remaining active branches of every input tree.
+ *  PruneTree() never enables branches and nothing is pruned if no inputs were declared.
+ *
+ **********************************************************************************/
+
+// C/C++
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <set>
+#include <string>
+
+// ROOT
+#include "TBranch.h"
+#include "TLeaf.h"
+#include "TTree.h"
+
+namespace Anp
+{
+  class BranchUsage
+  {
+  public:
+
+    static BranchUsage& Instance();
+
+    void DeclareVar   (const std::string &branch, const std::string &caller = "");
+    void DeclarePrefix(const std::string &prefix, const std::string &caller = "");
+    void DeclareScalars(const std::string &caller = "");
+
+    bool IsEmpty() const { return fVars.empty() && fPrefixes.empty() && fScalars.empty(); }
+
+    bool IsDeclared(const std::string &branch) const;
+
+    bool IsDeclared(TBranch *branch) const;
+
+    bool IsOverlap(const std::string &prefix) const;
+
+    unsigned PruneTree(TTree *tree, std::ostream &os = std::cout) const;
+
+    void Print(std::ostream &os = std::cout) const;
+
+    void Clear();
+
+    static bool IsScalar(TBranch *branch);
+
+  private:
+
+    typedef std::set<std::string>             StrSet;
+    typedef std::map<std::string, StrSet>     DeclMap;
+
+  private:
+
+    BranchUsage() {}
+    ~BranchUsage() {}
+
+    BranchUsage(const BranchUsage &);
+    BranchUsage& operator=(const BranchUsage &);
+
+  private:
+
+    DeclMap     fVars;        // Declared branch names and algorithms which declared them
+    DeclMap     fPrefixes;    // Declared branch prefixes and algorithms which declared them
+    StrSet      fScalars;     // Algorithms which declared all flat branches
+  };
+
+  //==============================================================================
+  // Inlined functions
+  //==============================================================================
+  inline BranchUsage& BranchUsage::Instance()
+  {
+    static BranchUsage usage;
+    return usage;
+  }
+
+  //==============================================================================
+  inline void BranchUsage::DeclareVar(const std::string &branch, const std::string &caller)
+  {
+    if(!branch.empty()) {
+      fVars[branch].insert(caller);
+    }
+  }
+
+  //==============================================================================
+  inline void BranchUsage::DeclarePrefix(const std::string &prefix, const std::string &caller)
+  {
+    if(!prefix.empty()) {
+      fPrefixes[prefix].insert(caller);
+    }
+  }
+
+  //==============================================================================
+  inline void BranchUsage::DeclareScalars(const std::string &caller)
+  {
+    fScalars.insert(caller);
+  }
+
+  //==============================================================================
+  inline bool BranchUsage::IsDeclared(const std::string &branch) const
+  {
+    if(fVars.count(branch)) {
+      return true;
+    }
+
+    for(const DeclMap::value_type &p: fPrefixes) {
+      if(branch.compare(0, p.first.size(), p.first) == 0) {
+	return true;
+      }
+    }
+
+    return false;
+  }
+
+  //==============================================================================
+  inline bool BranchUsage::IsDeclared(TBranch *branch) const
+  {
+    if(!branch) {
+      return false;
+    }
+
+    return IsDeclared(branch->GetName()) || (!fScalars.empty() && IsScalar(branch));
+  }
+
+  //==============================================================================
+  inline bool BranchUsage::IsOverlap(const std::string &prefix) const
+  {
+    //
+    // Some declared branch or prefix starts with prefix, or prefix starts with declared prefix
+    //
+    for(const DeclMap::value_type &p: fVars) {
+      if(p.first.compare(0, prefix.size(), prefix) == 0) {
+	return true;
+      }
+    }
+
+    for(const DeclMap::value_type &p: fPrefixes) {
+      if(p.first.compare(0, prefix.size(), prefix) == 0 || prefix.compare(0, p.first.size(), p.first) == 0) {
+	return true;
+      }
+    }
+
+    return false;
+  }
+
+  //==============================================================================
+  inline bool BranchUsage::IsScalar(TBranch *branch)
+  {
+    //
+    // Flat branch: plain TBranch with fixed length one leaves - not vector or array
+    //
+    if(!branch || branch->IsA() != TBranch::Class()) {
+      return false;
+    }
+
+    TObjArray *leaves = branch->GetListOfLeaves();
+
+    for(int i = 0; leaves && i < leaves->GetEntries(); ++i) {
+      TLeaf *leaf = dynamic_cast<TLeaf *>(leaves->At(i));
+
+      if(!leaf || leaf->GetLeafCount() || leaf->GetLenStatic() != 1) {
+	return false;
+      }
+    }
+
+    return leaves && leaves->GetEntries() > 0;
+  }
+
+  //==============================================================================
+  inline unsigned BranchUsage::PruneTree(TTree *tree, std::ostream &os) const
+  {
+    //
+    // Disable active top level branches which were not declared and print I/O saving:
+    // branches disabled by caller stay disabled and are not counted
+    //
+    if(!tree || IsEmpty()) {
+      return 0;
+    }
+
+    TObjArray *branches = tree->GetListOfBranches();
+
+    if(!branches) {
+      return 0;
+    }
+
+    unsigned nactive = 0, nkeep = 0;
+    double   zip_all = 0.0, zip_use = 0.0;
+
+    for(int i = 0; i < branches->GetEntries(); ++i) {
+      TBranch *branch = dynamic_cast<TBranch *>(branches->At(i));
+
+      if(!branch || !tree->GetBranchStatus(branch->GetName())) {
+	continue;
+      }
+
+      const double nbytes = branch->GetZipBytes("*");
+
+      zip_all += nbytes;
+      ++nactive;
+
+      if(IsDeclared(branch)) {
+	zip_use += nbytes;
+	++nkeep;
+      }
+      else {
+	tree->SetBranchStatus(branch->GetName(), 0);
+      }
+    }
+
+    const double nentry = tree->GetEntries();
+
+    if(nentry > 0.0 && zip_all > 0.0) {
+      const std::streamsize prec = os.precision();
+
+      os << "BranchUsage::PruneTree - " << tree->GetName() << ": " << nkeep << "/" << nactive
+	 << " active branches kept" << std::endl
+	 << "   compressed bytes per event: " << std::fixed << std::setprecision(1)
+	 << zip_use/nentry << " of " << zip_all/nentry
+	 << " (saving " << 100.0*(1.0 - zip_use/zip_all) << "%)" << std::endl;
+
+      os.unsetf(std::ios_base::floatfield);
+      os.precision(prec);
+    }
+
+    return nkeep;
+  }
+
+  //==============================================================================
+  inline void BranchUsage::Print(std::ostream &os) const
+  {
+    os << "BranchUsage::Print - " << fVars.size() << " variable(s) and "
+       << fPrefixes.size() << " prefix(es) declared" << std::endl;
+
+    if(!fScalars.empty()) {
+      os << "   scalars" << std::string(31, ' ');
+      for(const std::string &caller: fScalars) {
+	os << " " << caller;
+      }
+      os << std::endl;
+    }
+
+    for(const DeclMap::value_type &p: fVars) {
+      os << "   var    " << std::setw(30) << std::left << p.first << std::right;
+      for(const std::string &caller: p.second) {
+	os << " " << caller;
+      }
+      os << std::endl;
+    }
+
+    for(const DeclMap::value_type &p: fPrefixes) {
+      os << "   prefix " << std::setw(30) << std::left << p.first << std::right;
+      for(const std::string &caller: p.second) {
+	os << " " << caller;
+      }
+      os << std::endl;
+    }
+  }
+
+  //==============================================================================
+  inline void BranchUsage::Clear()
+  {
+    fVars.clear();
+    fPrefixes.clear();
+    fScalars.clear();
+  }
+}
+
+#endif
@@ -0,0 +1,367 @@
+// -*- c++ -*-
+#ifndef ANP_CHUNKPLAN_H
+#define ANP_CHUNKPLAN_H
+
+/**********************************************************************************
+ * @Package: PhysicsAnpBase
+ * @Class  : ChunkPlan
+ * @Author : Rustem Ospanov
+ *
+ * @Brief  : Split job input files into (file, entry range) chunks for parallel loops
+ *
+ *  Make() is called by ReadProcs before worker processes are forked:
+ *   - ScanThreads > 1: files are opened concurrently by InputScan, invalid files dropped
+ *   - entries are counted with InputScan, EntryIndex or by opening files
+ *   - ChunkMB > 0 with UseEntryIndex: entry counts and compressed sizes are read from
+ *     EntryIndex, InputScan opens only files missing from index (and one file for
+ *     fraction of bytes in declared branches with PruneBranches)
+ *   - MinLB/MaxLB: only entry ranges of selected lumi blocks (LumiIndex)
+ *   - ReplaySkim: only entries listed in SkimList file
+ *   - EventFracMin/EventFracMax: only selected fraction of entries
+ *   - NEvent: at most NEvent entries in total
+ *
+ *  Chunk size:
+ *   - ChunkMB > 0: chunks of about ChunkMB compressed MB - entries per chunk are
+ *     computed for every file from compressed tree size, so that files with
+ *     large events make more chunks than files with small events. PruneBranches:
+ *     only branches declared in BranchUsage are counted (ReadLoop::DeclareUsage()
+ *     is called before Make())
+ *   - otherwise: chunks of at most EventsPerChunk entries
+ *
+ **********************************************************************************/
+
+// C/C++
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+// Base
+#include "PhysicsAnpBase/EntryIndex.h"
+#include "PhysicsAnpBase/EventChunk.h"
+#include "PhysicsAnpBase/InputScan.h"
+#include "PhysicsAnpBase/LumiIndex.h"
+#include "PhysicsAnpBase/Registry.h"
+#include "PhysicsAnpBase/SkimList.h"
+
+namespace Anp
+{
+  class ChunkPlan
+  {
+  public:
+
+    ChunkPlan();
+    ~ChunkPlan() {}
+
+    void Config(const Registry &reg);
+
+    bool Make(std::vector<std::string> &fpaths, ChunkVec &chunks) const;
+
+    bool IsFracSelected() const { return fEventFracMin < fEventFracMax; }
+
+  private:
+
+    void ReadIndexBytes(EntryIndex               &index,
+			std::vector<std::string> &fpaths,
+			std::vector<long>        &counts,
+			std::vector<double>      &bytes_per_entry) const;
+
+    std::ostream& log() const;
+
+  private:
+
+    // Properties:
+    bool                       fDebug;              // Print debug info
+    std::string                fTreeName;           // Name of input ROOT tree
+    bool                       fPruneBranches;      // ChunkMB counts only branches declared in BranchUsage
+    bool                       fUseEntryIndex;      // Read entry counts from sidecar EntryIndex
+    std::string                fIndexDir;           // Directory for EntryIndex and LumiIndex sidecars
+    unsigned                   fScanThreads;        // Number of threads for InputScan of input files
+    long                       fNEvent;             // Maximum number of events to read
+    long                       fEventsPerChunk;     // Maximum number of entries per chunk
+    double                     fChunkMB;            // Compressed MB per chunk: used instead of EventsPerChunk if > 0
+    int                        fMinLB;              // Minimum lumi block: read only entries from LumiIndex ranges
+    int                        fMaxLB;              // Maximum lumi block: read only entries from LumiIndex ranges
+    std::string                fRunBranch;          // Name of run number branch for LumiIndex
+    std::string                fLBBranch;           // Name of lumi block branch for LumiIndex
+    std::string                fReplaySkim;         // Path of SkimList file: read only listed entries
+    std::string                fReplaySkimName;     // Name of skim to read: all skims if empty
+    double                     fEventFracMin;       // Read only fraction [EventFracMin, EventFracMax) of entries
+    double                     fEventFracMax;
+    bool                       fEventFracStratified; // Take same fraction of every file and lumi block
+  };
+
+  //==============================================================================
+  // Inlined functions
+  //==============================================================================
+  inline ChunkPlan::ChunkPlan()
+    :fDebug         (false),
+     fPruneBranches (false),
+     fUseEntryIndex (true),
+     fIndexDir      (GetDefaultSidecarDir()),
+     fScanThreads   (0),
+     fNEvent        (0),
+     fEventsPerChunk(100000),
+     fChunkMB       (0.0),
+     fMinLB         (0),
+     fMaxLB         (0),
+     fRunBranch     ("Run"),
+     fLBBranch      ("LumiBlock"),
+     fEventFracMin  (0.0),
+     fEventFracMax  (0.0),
+     fEventFracStratified(false)
+  {
+  }
+
+  //==============================================================================
+  inline void ChunkPlan::Config(const Registry &reg)
+  {
+    reg.Get("Debug",          fDebug);
+    reg.Get("TreeName",       fTreeName);
+    reg.Get("NEvent",         fNEvent);
+    reg.Get("EventsPerChunk", fEventsPerChunk);
+    reg.Get("ChunkMB",        fChunkMB);
+    reg.Get("PruneBranches",  fPruneBranches);
+    reg.Get("UseEntryIndex",  fUseEntryIndex);
+    reg.Get("IndexDir",       fIndexDir);
+    reg.Get("ScanThreads",    fScanThreads);
+    reg.Get("MinLB",          fMinLB);
+    reg.Get("MaxLB",          fMaxLB);
+    reg.Get("LumiRunBranch",  fRunBranch);
+    reg.Get("LumiLBBranch",   fLBBranch);
+    reg.Get("ReplaySkim",     fReplaySkim);
+    reg.Get("ReplaySkimName", fReplaySkimName);
+    reg.Get("EventFracMin",   fEventFracMin);
+    reg.Get("EventFracMax",   fEventFracMax);
+    reg.Get("EventFracStratified", fEventFracStratified);
+  }
+
+  //==============================================================================
+  inline bool ChunkPlan::Make(std::vector<std::string> &fpaths, ChunkVec &chunks) const
+  {
+    chunks.clear();
+
+    //
+    // Count entries: compressed sizes for ChunkMB are read from EntryIndex, only
+    // files without complete index entry are opened by InputScan
+    //
+    std::vector<long>   counts;
+    std::vector<double> bytes_per_entry;
+    EntryIndex          index;
+
+    index.SetDebug(fDebug);
+    index.SetIndexDir(fIndexDir);
+
+    if(fScanThreads > 1 || (fChunkMB > 0.0 && !fUseEntryIndex)) {
+      InputScan scan;
+      scan.SetNThreads(std::max<unsigned>(fScanThreads, 1));
+      scan.SetTreeName(fTreeName);
+      scan.SetPrune(fPruneBranches);
+      scan.Scan(fpaths);
+      scan.Print();
+
+      fpaths = scan.GetValidFiles();
+
+      for(const std::string &fpath: fpaths) {
+	counts.push_back(scan.GetEntries(fpath));
+	bytes_per_entry.push_back(scan.GetBytesPerEntry(fpath));
+      }
+
+      if(fUseEntryIndex) {
+	for(const InputFile &file: scan.GetPlan()) {
+	  if(file.valid) {
+	    index.Store(file.file_path, fTreeName, file.nentry, file.zip_bytes);
+	  }
+	}
+      }
+    }
+    else if(fChunkMB > 0.0) {
+      ReadIndexBytes(index, fpaths, counts, bytes_per_entry);
+    }
+    else {
+      for(const std::string &fpath: fpaths) {
+	if(fUseEntryIndex) {
+	  counts.push_back(index.GetEntries(fpath, fTreeName));
+	}
+	else {
+	  counts.push_back(CountTreeEntries(fpath, fTreeName));
+	}
+      }
+    }
+
+    if(fUseEntryIndex) {
+      index.Save();
+      index.Print();
+    }
+
+    //
+    // Entry ranges: whole files or only selected entries
+    //
+    ChunkVec ranges;
+
+    const bool select_frac = IsFracSelected();
+
+    if(fMinLB > 0 || fMaxLB > 0 || !fReplaySkim.empty() || select_frac) {
+      //
+      // Seek directly to entries of selected lumi blocks and listed skim entries,
+      // skip files without them
+      //
+      LumiIndex lumi;
+      lumi.SetDebug(fDebug);
+      lumi.SetIndexDir(fIndexDir);
+      lumi.SetBranches(fRunBranch, fLBBranch);
+
+      SkimList skim;
+
+      if(!fReplaySkim.empty() && !skim.Load(fReplaySkim, fReplaySkimName)) {
+	return false;
+      }
+
+      for(unsigned i = 0; i < fpaths.size(); ++i) {
+	ChunkVec file_ranges;
+
+	if(!((fMinLB > 0 || fMaxLB > 0) && lumi.SelectEntries(fpaths.at(i), fTreeName, fMinLB, fMaxLB, file_ranges))) {
+	  file_ranges = MakeEventChunks(std::vector<std::string>(1, fpaths.at(i)),
+					std::vector<long>       (1, counts.at(i)), fTreeName, 0);
+	}
+
+	if(skim.IsLoaded()) {
+	  ChunkVec skim_ranges;
+	  skim.SelectEntries(fpaths.at(i), fTreeName, skim_ranges);
+
+	  file_ranges = IntersectEventChunks(file_ranges, skim_ranges);
+	}
+
+	ChunkVec lb_ranges;
+
+	if(select_frac && fEventFracStratified && lumi.GetLumiChunks(fpaths.at(i), fTreeName, lb_ranges)) {
+	  file_ranges = IntersectEventChunks(lb_ranges, file_ranges);
+	}
+
+	for(EventChunk &range: file_ranges) {
+	  range.file_index = i;
+	  ranges.push_back(range);
+	}
+      }
+
+      lumi.Save();
+      lumi.Print();
+      skim.Print();
+
+      if(select_frac) {
+	//
+	// Entries outside of selected fraction are never assigned to workers
+	//
+	ranges = SelectFractionChunks(ranges, fEventFracMin, fEventFracMax, fEventFracStratified, fNEvent);
+      }
+
+      ranges = SplitEventChunks(ranges, 0, fNEvent);
+    }
+    else {
+      ranges = MakeEventChunks(fpaths, counts, fTreeName, 0, fNEvent);
+    }
+
+    //
+    // Split ranges into chunks
+    //
+    if(fChunkMB > 0.0) {
+      chunks = SplitEventChunksByBytes(ranges, bytes_per_entry, fChunkMB*1048576.0);
+    }
+    else {
+      chunks = SplitEventChunks(ranges, fEventsPerChunk);
+    }
+
+    if(fDebug) {
+      log() << "Make - " << fpaths.size() << " input file(s) split into " << chunks.size() << " chunk(s)" << std::endl;
+    }
+
+    return true;
+  }
+
+  //==============================================================================
+  inline void ChunkPlan::ReadIndexBytes(EntryIndex               &index,
+					std::vector<std::string> &fpaths,
+					std::vector<long>        &counts,
+					std::vector<double>      &bytes_per_entry) const
+  {
+    //
+    // Entry counts and compressed sizes from EntryIndex: InputScan opens only missing files
+    //
+    std::vector<long>        nentry(fpaths.size(), 0);
+    std::vector<long long>   zip_bytes(fpaths.size(), -1);
+    std::vector<std::string> missing;
+
+    for(unsigned i = 0; i < fpaths.size(); ++i) {
+      if(!index.Find(fpaths.at(i), fTreeName, nentry.at(i), zip_bytes.at(i))) {
+	missing.push_back(fpaths.at(i));
+      }
+    }
+
+    if(missing.empty() && fPruneBranches && !BranchUsage::Instance().IsEmpty() && !fpaths.empty()) {
+      //
+      // Index has size of whole tree: fraction of bytes in declared branches is measured on one file
+      //
+      missing.push_back(fpaths.front());
+    }
+
+    InputScan scan;
+
+    if(!missing.empty()) {
+      scan.SetNThreads(1);
+      scan.SetTreeName(fTreeName);
+      scan.SetPrune(fPruneBranches);
+      scan.Scan(missing);
+      scan.Print();
+    }
+
+    double scan_zip = 0.0, scan_use = 0.0;
+
+    for(const InputFile &file: scan.GetPlan()) {
+      if(file.valid) {
+	index.Store(file.file_path, fTreeName, file.nentry, file.zip_bytes);
+
+	scan_zip += file.zip_bytes;
+	scan_use += file.use_bytes;
+      }
+    }
+
+    const double use_frac = (scan_zip > 0.0 ? scan_use/scan_zip : 1.0);
+
+    std::map<std::string, const InputFile *> scanned;
+
+    for(const InputFile &file: scan.GetPlan()) {
+      scanned[file.file_path] = &file;
+    }
+
+    std::vector<std::string> valid_paths;
+
+    for(unsigned i = 0; i < fpaths.size(); ++i) {
+      const std::map<std::string, const InputFile *>::const_iterator fit = scanned.find(fpaths.at(i));
+
+      if(fit == scanned.end()) {
+	counts.push_back(nentry.at(i));
+	bytes_per_entry.push_back(nentry.at(i) > 0 ? use_frac*zip_bytes.at(i)/nentry.at(i) : 0.0);
+      }
+      else if(fit->second->valid) {
+	counts.push_back(fit->second->nentry);
+	bytes_per_entry.push_back(scan.GetBytesPerEntry(fpaths.at(i)));
+      }
+      else {
+	continue;
+      }
+
+      valid_paths.push_back(fpaths.at(i));
+    }
+
+    fpaths = valid_paths;
+  }
+
+  //==============================================================================
+  inline std::ostream& ChunkPlan::log() const
+  {
+    std::cout << "ChunkPlan::";
+    return std::cout;
+  }
+}
+
+#endif
@@ -0,0 +1,260 @@
+// -*- c++ -*-
+#ifndef ANP_CHUNKSCHEDULER_H
+#define ANP_CHUNKSCHEDULER_H
+
+/**********************************************************************************
+ * @Package: PhysicsAnpBase
+ * @Class  : ChunkScheduler
+ * @Author : Rustem Ospanov
+ *
+ * @Brief  : Work-stealing scheduler of event chunks for worker threads and processes
+ *
+ *  Chunks (ChunkPlan) are dealt to workers in contiguous blocks in file order:
+ *  each worker owns a deque of chunk indices [head, tail).
+ *
+ *  Next(worker):
+ *   - worker pops chunks from head of its own deque: consecutive chunks of
+ *     same file, so input file is rarely reopened
+ *   - when own deque is empty, worker steals one chunk from tail of deque with
+ *     most remaining chunks, i.e. chunk furthest away from victim's current file
+ *   - false is returned when all deques are empty
+ *
+ *  Idle workers keep taking work until the last chunk is read, so that job
+ *  finishes within about one chunk of time after all workers started idling.
+ *
+ *  Head and tail of each deque are packed into one 64 bit word which is updated
+ *  by compare-and-swap: no locks are needed and the same code works for threads
+ *  and for forked processes (Shared=true: deques are in MAP_SHARED memory).
+ *  Chunk list itself is read-only after Init() and is inherited by children.
+ *
+ **********************************************************************************/
+
+// C/C++
+#include <iostream>
+#include <stdint.h>
+#include <vector>
+
+// POSIX
+#include <sys/mman.h>
+
+// Base
+#include "PhysicsAnpBase/EventChunk.h"
+
+namespace Anp
+{
+  class ChunkScheduler
+  {
+  public:
+
+    ChunkScheduler();
+    ~ChunkScheduler();
+
+    bool Init(const ChunkVec &chunks, unsigned nworker, bool shared);
+
+    bool Next(unsigned worker, EventChunk &chunk);
+
+    unsigned GetNChunk()  const { return fChunks.size(); }
+    unsigned GetNWorker() const { return fNWorker; }
+
+    long GetNPop  (unsigned worker) const;
+    long GetNSteal(unsigned worker) const;
+
+    void Print(std::ostream &os = std::cout) const;
+
+  private:
+
+    struct Deque
+    {
+      volatile uint64_t range;     // Packed [head, tail) of chunk indices
+      long              npop;      // Chunks taken from own deque
+      long              nsteal;    // Chunks stolen from other deques
+      char              pad[40];   // Keep deques of different workers in different cache lines
+    };
+
+  private:
+
+    static uint64_t Pack(uint32_t head, uint32_t tail) { return (uint64_t(tail) << 32) | head; }
+
+    static uint32_t GetHead(uint64_t range) { return uint32_t(range & 0xffffffff); }
+    static uint32_t GetTail(uint64_t range) { return uint32_t(range >> 32); }
+
+    void Clear();
+
+  private:
+
+    ChunkScheduler(const ChunkScheduler &);
+    ChunkScheduler& operator=(const ChunkScheduler &);
+
+  private:
+
+    ChunkVec       fChunks;       // All chunks: read-only after Init()
+    Deque         *fDeques;       // One deque per worker
+    unsigned       fNWorker;
+    bool           fShared;       // Deques are in memory shared by forked processes
+  };
+
+  //==============================================================================
+  // Inlined functions
+  //==============================================================================
+  inline ChunkScheduler::ChunkScheduler()
+    :fDeques (0),
+     fNWorker(0),
+     fShared (false)
+  {
+  }
+
+  //==============================================================================
+  inline ChunkScheduler::~ChunkScheduler()
+  {
+    Clear();
+  }
+
+  //==============================================================================
+  inline void ChunkScheduler::Clear()
+  {
+    if(fDeques && fShared) {
+      munmap(fDeques, fNWorker*sizeof(Deque));
+    }
+    else {
+      delete [] fDeques;
+    }
+
+    fDeques  = 0;
+    fNWorker = 0;
+    fChunks.clear();
+  }
+
+  //==============================================================================
+  inline bool ChunkScheduler::Init(const ChunkVec &chunks, unsigned nworker, bool shared)
+  {
+    Clear();
+
+    if(nworker < 1 || chunks.size() >= 0xffffffff) {
+      std::cerr << "ChunkScheduler::Init - invalid number of workers or chunks" << std::endl;
+      return false;
+    }
+
+    fChunks  = chunks;
+    fNWorker = nworker;
+    fShared  = shared;
+
+    if(fShared) {
+      void *mem = mmap(0, fNWorker*sizeof(Deque), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+      if(mem == MAP_FAILED) {
+	std::cerr << "ChunkScheduler::Init - mmap failed: can not share deques" << std::endl;
+	fNWorker = 0;
+	return false;
+      }
+
+      fDeques = static_cast<Deque *>(mem);
+    }
+    else {
+      fDeques = new Deque[fNWorker];
+    }
+
+    //
+    // Deal contiguous blocks of chunks: deterministic initial assignment
+    //
+    const uint64_t nchunk = fChunks.size();
+
+    for(unsigned i = 0; i < fNWorker; ++i) {
+      fDeques[i].range  = Pack(uint32_t(i*nchunk/fNWorker), uint32_t((i+1)*nchunk/fNWorker));
+      fDeques[i].npop   = 0;
+      fDeques[i].nsteal = 0;
+    }
+
+    return true;
+  }
+
+  //==============================================================================
+  inline bool ChunkScheduler::Next(unsigned worker, EventChunk &chunk)
+  {
+    if(worker >= fNWorker) {
+      return false;
+    }
+
+    Deque &own = fDeques[worker];
+
+    //
+    // Pop from head of own deque
+    //
+    while(true) {
+      const uint64_t range = own.range;
+      const uint32_t head  = GetHead(range);
+      const uint32_t tail  = GetTail(range);
+
+      if(head >= tail) {
+	break;
+      }
+
+      if(__sync_bool_compare_and_swap(&own.range, range, Pack(head+1, tail))) {
+	chunk = fChunks.at(head);
+	own.npop++;
+	return true;
+      }
+    }
+
+    //
+    // Steal from tail of deque with most remaining chunks
+    //
+    while(true) {
+      Deque   *victim = 0;
+      uint64_t vrange = 0;
+      uint32_t vsize  = 0;
+
+      for(unsigned i = 0; i < fNWorker; ++i) {
+	const uint64_t range = fDeques[i].range;
+	const uint32_t head  = GetHead(range);
+	const uint32_t tail  = GetTail(range);
+
+	if(head < tail && tail-head > vsize) {
+	  victim = &fDeques[i];
+	  vrange = range;
+	  vsize  = tail-head;
+	}
+      }
+
+      if(!victim) {
+	return false;
+      }
+
+      const uint32_t tail = GetTail(vrange);
+
+      if(__sync_bool_compare_and_swap(&victim->range, vrange, Pack(GetHead(vrange), tail-1))) {
+	chunk = fChunks.at(tail-1);
+	own.nsteal++;
+	return true;
+      }
+    }
+
+    return false;
+  }
+
+  //==============================================================================
+  inline long ChunkScheduler::GetNPop(unsigned worker) const
+  {
+    return worker < fNWorker ? fDeques[worker].npop : 0;
+  }
+
+  //==============================================================================
+  inline long ChunkScheduler::GetNSteal(unsigned worker) const
+  {
+    return worker < fNWorker ? fDeques[worker].nsteal : 0;
+  }
+
+  //==============================================================================
+  inline void ChunkScheduler::Print(std::ostream &os) const
+  {
+    long nsteal = 0;
+
+    for(unsigned i = 0; i < fNWorker; ++i) {
+      nsteal += fDeques[i].nsteal;
+    }
+
+    os << "ChunkScheduler::Print - " << fChunks.size() << " chunk(s) for " << fNWorker << " worker(s): "
+       << nsteal << " chunk(s) stolen" << std::endl;
+  }
+}
+
+#endif
@@ -14,6 +14,7 @@
 // C/C++
 #include <iostream>
 #include <map>
+#include <sstream>
 
 // Data
 #include "PhysicsAnpData/Ptr.h"
@@ -57,6 +58,10 @@ namespace Anp
 
     void SetDebug(bool flag) { fDebug = flag; }
 
+    void SaveState(Registry &state) const;
+
+    void LoadState(const Registry &state);
+
   public:
 
     struct CutPair
@@ -147,6 +152,46 @@ namespace Anp
 
     return Cut::Fail;
   }
+
+  //-----------------------------------------------------------------------------
+  // Checkpoint of counts of input and all cuts: cuts are identified by order
+  //
+  inline void CutFlow::SaveState(Registry &state) const
+  {
+    if(fInput.valid()) {
+      Registry poll;
+      fInput->SaveState(poll);
+      state.Set("Input", poll);
+    }
+
+    for(unsigned i = 0; i < fCuts.size(); ++i) {
+      std::stringstream key;
+      key << "Cut" << i;
+
+      Registry poll;
+      fCuts.at(i)->poll.SaveState(poll);
+      state.Set(key.str(), poll);
+    }
+  }
+
+  //-----------------------------------------------------------------------------
+  inline void CutFlow::LoadState(const Registry &state)
+  {
+    Registry poll;
+
+    if(fInput.valid() && state.Get("Input", poll)) {
+      fInput->LoadState(poll);
+    }
+
+    for(unsigned i = 0; i < fCuts.size(); ++i) {
+      std::stringstream key;
+      key << "Cut" << i;
+
+      if(state.Get(key.str(), poll)) {
+	fCuts.at(i)->poll.LoadState(poll);
+      }
+    }
+  }
 }
 
 #endif
@@ -0,0 +1,511 @@
+// -*- c++ -*-
+#ifndef ANP_EVENTCACHE_H
+#define ANP_EVENTCACHE_H
+
+/**********************************************************************************
+ * @Package: PhysicsAnpBase
+ * @Class  : EventCache
+ * @Author : Rustem Ospanov
+ *
+ * @Brief  : Compressed cache of active branches of selected events for replay passes
+ *
+ *  Open() clones active branches of input tree (TTree::CloneTree(0)) into new
+ *  cache segment: clone shares branch buffers with input tree, so Fill() copies
+ *  entry which was just read and ROOT compresses cached entries in baskets.
+ *
+ *  Segments are kept in TMemFile while total size of memory segments is below
+ *  MemoryBudget. After budget is exhausted, new segments are written to local
+ *  files in SpillDir: replay never reads original (possibly remote) input files.
+ *
+ *  Replay: GetSegmentPath() returns local file with cached tree "cache" of one
+ *  segment, which is read exactly like input file. Memory segment is written to
+ *  SpillDir when its path is first requested and its memory is released.
+ *  GetPass() returns replay pass number (1..N) while cached events are read and
+ *  0 otherwise, so that algorithms can tell replay passes apart.
+ *
+ *  Spill files are written only if SpillDir has at least MinFreeBytes free space
+ *  in addition to size of written segment: free space is checked before a segment
+ *  is opened and every 1000 filled entries. If space runs out, cache stops filling
+ *  and IsComplete() returns false: incomplete cache must not be replayed.
+ *
+ *  Clone shares branch buffers with input tree: readers which set their own
+ *  addresses or read only some branches of entry (TwoPhaseRead) must not be
+ *  used together with EventCache.
+ *
+ *  Spill files are removed by Clear() and destructor.
+ *
+ **********************************************************************************/
+
+// C/C++
+#include <cstdio>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// POSIX
+#include <sys/statvfs.h>
+#include <unistd.h>
+
+// ROOT
+#include "TDirectory.h"
+#include "TFile.h"
+#include "TMemFile.h"
+#include "TTree.h"
+
+namespace Anp
+{
+  class EventCache
+  {
+  public:
+
+    EventCache();
+    ~EventCache();
+
+    void SetMemoryBudget(long long bytes)       { fMemoryBudget = bytes; }
+    void SetSpillDir    (const std::string &dir) { fSpillDir     = dir;   }
+    void SetMinFreeBytes(long long bytes)       { fMinFreeBytes = bytes; }
+    void SetDebug       (bool flag)              { fDebug        = flag;  }
+
+    //
+    // Record entries
+    //
+    bool Open(TTree *input);
+
+    bool Fill();
+
+    void Close();
+
+    //
+    // Replay entries
+    //
+    unsigned GetNSegment() const { return fSegments.size(); }
+
+    std::string GetSegmentPath(unsigned index);
+
+    long GetSegmentNEvent(unsigned index) const;
+
+    long      GetNEvent()   const;
+    long long GetMemBytes() const;
+
+    bool IsComplete() const { return !fFailed; }
+
+    //
+    // Replay pass number: set by reader of cached events
+    //
+    static unsigned GetPass()              { return PassRef(); }
+    static void     SetPass(unsigned pass) { PassRef() = pass; }
+
+    static std::string GetReplayPath(const std::string &output_path);
+
+    void Print(std::ostream &os = std::cout) const;
+
+    void Clear();
+
+  private:
+
+    struct Segment
+    {
+      Segment() :file(0), tree(0), nevent(0), in_memory(false) {}
+
+      TFile        *file;
+      TTree        *tree;
+      std::string   spill_path;   // Local file path for spilled segment
+      long          nevent;
+      bool          in_memory;
+    };
+
+    typedef std::vector<Segment> SegmentVec;
+
+  private:
+
+    bool OpenSegmentFile(Segment &seg);
+
+    void SealSegment(Segment &seg);
+
+    bool HasFreeSpace(long long nbytes) const;
+
+    static unsigned& PassRef() { static unsigned pass = 0; return pass; }
+
+  private:
+
+    EventCache(const EventCache &);
+    EventCache& operator=(const EventCache &);
+
+  private:
+
+    bool            fDebug;
+    long long       fMemoryBudget;   // Maximum compressed bytes kept in memory
+    std::string     fSpillDir;       // Directory for spilled segments
+    long long       fMinFreeBytes;   // Free space kept in SpillDir
+
+    TTree          *fInput;          // Current input tree
+    SegmentVec      fSegments;
+    bool            fOpen;           // Last segment is filled
+    bool            fFailed;         // Cache stopped filling: events are missing
+  };
+
+  //==============================================================================
+  // Inlined functions
+  //==============================================================================
+  inline EventCache::EventCache()
+    :fDebug       (false),
+     fMemoryBudget(512ll*1048576ll),
+     fSpillDir    ("/tmp"),
+     fMinFreeBytes(1024ll*1048576ll),
+     fInput       (0),
+     fOpen        (false),
+     fFailed      (false)
+  {
+  }
+
+  //==============================================================================
+  inline EventCache::~EventCache()
+  {
+    Clear();
+  }
+
+  //==============================================================================
+  inline bool EventCache::Open(TTree *input)
+  {
+    Close();
+
+    if(!input || fFailed) {
+      return false;
+    }
+
+    fInput = input;
+
+    Segment seg;
+
+    if(!OpenSegmentFile(seg)) {
+      fInput  = 0;
+      fFailed = true;
+      return false;
+    }
+
+    fSegments.push_back(seg);
+    fOpen = true;
+
+    return true;
+  }
+
+  //==============================================================================
+  inline bool EventCache::OpenSegmentFile(Segment &seg)
+  {
+    std::stringstream name;
+    name << "anp_event_cache_" << getpid() << "_" << fSegments.size();
+
+    seg.in_memory = GetMemBytes() < fMemoryBudget;
+
+    if(seg.in_memory) {
+      seg.file = new TMemFile((name.str() + ".root").c_str(), "RECREATE");
+    }
+    else if(HasFreeSpace(0)) {
+      seg.spill_path = fSpillDir + "/" + name.str() + ".root";
+      seg.file       = TFile::Open(seg.spill_path.c_str(), "RECREATE");
+    }
+
+    if(!seg.file || !seg.file->IsOpen()) {
+      std::cerr << "EventCache::OpenSegmentFile - failed to create segment: " << name.str() << std::endl;
+      delete seg.file;
+      seg.file = 0;
+      return false;
+    }
+
+    //
+    // Clone is created in current directory: only active branches are cloned
+    //
+    TDirectory *dir = gDirectory;
+    seg.file->cd();
+
+    seg.tree = fInput->CloneTree(0);
+
+    if(dir) {
+      dir->cd();
+    }
+
+    if(!seg.tree) {
+      std::cerr << "EventCache::OpenSegmentFile - failed to clone input tree" << std::endl;
+      seg.file->Close();
+      delete seg.file;
+      seg.file = 0;
+      return false;
+    }
+
+    seg.tree->SetName("cache");
+
+    return true;
+  }
+
+  //==============================================================================
+  inline bool EventCache::Fill()
+  {
+    if(!fOpen || fSegments.empty()) {
+      return false;
+    }
+
+    Segment &seg = fSegments.back();
+
+    seg.tree->Fill();
+    seg.nevent++;
+
+    if(!seg.in_memory && seg.nevent % 1000 == 0 && !HasFreeSpace(0)) {
+      //
+      // Local disk is full: stop filling, cache is incomplete
+      //
+      SealSegment(seg);
+      fOpen   = false;
+      fFailed = true;
+      return false;
+    }
+
+    if(seg.in_memory && GetMemBytes() > fMemoryBudget) {
+      //
+      // Memory budget is exhausted: keep this segment and continue on local disk
+      //
+      SealSegment(seg);
+
+      Segment spill;
+
+      if(!OpenSegmentFile(spill)) {
+	fOpen   = false;
+	fFailed = true;
+	return false;
+      }
+
+      fSegments.push_back(spill);
+
+      if(fDebug) {
+	std::cout << "EventCache::Fill - memory budget exhausted: spill to " << spill.spill_path << std::endl;
+      }
+    }
+
+    return true;
+  }
+
+  //==============================================================================
+  inline void EventCache::Close()
+  {
+    if(fOpen && !fSegments.empty()) {
+      SealSegment(fSegments.back());
+    }
+
+    fOpen  = false;
+    fInput = 0;
+  }
+
+  //==============================================================================
+  inline void EventCache::SealSegment(Segment &seg)
+  {
+    if(!seg.file || !seg.tree) {
+      return;
+    }
+
+    //
+    // Clone must be detached from input tree which is closed with input file
+    //
+    if(fInput) {
+      fInput->RemoveClone(seg.tree);
+    }
+
+    TDirectory *dir = gDirectory;
+    seg.file->cd();
+
+    seg.tree->Write();
+
+    if(dir) {
+      dir->cd();
+    }
+
+    //
+    // Branch buffers are shared with input tree: replay binds its own addresses
+    //
+    seg.tree->ResetBranchAddresses();
+
+    if(!seg.in_memory) {
+      //
+      // Spilled segments are reopened for replay
+      //
+      seg.file->Close();
+      delete seg.file;
+
+      seg.file = 0;
+      seg.tree = 0;
+    }
+  }
+
+  //==============================================================================
+  inline std::string EventCache::GetSegmentPath(unsigned index)
+  {
+    if(index >= fSegments.size()) {
+      return "";
+    }
+
+    Segment &seg = fSegments.at(index);
+
+    if(!seg.in_memory) {
+      return seg.spill_path;
+    }
+
+    if(!seg.file || !seg.tree) {
+      return "";
+    }
+
+    //
+    // Replay reads files: write memory segment to local file and release memory
+    //
+    if(!HasFreeSpace(seg.file->GetSize())) {
+      return "";
+    }
+
+    std::stringstream name;
+    name << fSpillDir << "/anp_event_cache_" << getpid() << "_" << index << ".root";
+
+    TDirectory *dir  = gDirectory;
+    TFile      *file = TFile::Open(name.str().c_str(), "RECREATE");
+
+    if(!file || !file->IsOpen()) {
+      std::cerr << "EventCache::GetSegmentPath - failed to create: " << name.str() << std::endl;
+      delete file;
+
+      if(dir) {
+	dir->cd();
+      }
+
+      return "";
+    }
+
+    file->cd();
+
+    TTree *copy = seg.tree->CloneTree(-1, "fast");
+
+    if(copy) {
+      copy->Write();
+    }
+
+    file->Close();
+    delete file;
+
+    if(dir) {
+      dir->cd();
+    }
+
+    seg.file->Close();
+    delete seg.file;
+
+    seg.file       = 0;
+    seg.tree       = 0;
+    seg.spill_path = name.str();
+    seg.in_memory  = false;
+
+    return copy ? seg.spill_path : "";
+  }
+
+  //==============================================================================
+  inline bool EventCache::HasFreeSpace(long long nbytes) const
+  {
+    struct statvfs st;
+
+    if(statvfs(fSpillDir.c_str(), &st) != 0) {
+      std::cerr << "EventCache::HasFreeSpace - failed to stat spill directory: " << fSpillDir << std::endl;
+      return false;
+    }
+
+    const long long nfree = static_cast<long long>(st.f_bavail)*static_cast<long long>(st.f_frsize);
+
+    if(nfree < nbytes + fMinFreeBytes) {
+      std::cerr << "EventCache::HasFreeSpace - " << nfree/1048576 << " MB free in " << fSpillDir
+		<< ": need " << (nbytes + fMinFreeBytes)/1048576 << " MB" << std::endl;
+      return false;
+    }
+
+    return true;
+  }
+
+  //==============================================================================
+  inline std::string EventCache::GetReplayPath(const std::string &output_path)
+  {
+    if(output_path.empty()) {
+      return "";
+    }
+
+    std::string stem = output_path;
+
+    if(stem.size() > 5 && stem.substr(stem.size()-5) == ".root") {
+      stem = stem.substr(0, stem.size()-5);
+    }
+
+    return stem + "_replay.root";
+  }
+
+  //==============================================================================
+  inline long EventCache::GetSegmentNEvent(unsigned index) const
+  {
+    return index < fSegments.size() ? fSegments.at(index).nevent : 0;
+  }
+
+  //==============================================================================
+  inline long EventCache::GetNEvent() const
+  {
+    long nevent = 0;
+
+    for(const Segment &seg: fSegments) {
+      nevent += seg.nevent;
+    }
+
+    return nevent;
+  }
+
+  //==============================================================================
+  inline long long EventCache::GetMemBytes() const
+  {
+    long long nbytes = 0;
+
+    for(const Segment &seg: fSegments) {
+      if(seg.in_memory && seg.file) {
+	nbytes += seg.file->GetSize();
+      }
+    }
+
+    return nbytes;
+  }
+
+  //==============================================================================
+  inline void EventCache::Print(std::ostream &os) const
+  {
+    unsigned nspill = 0;
+
+    for(const Segment &seg: fSegments) {
+      if(!seg.in_memory) {
+	++nspill;
+      }
+    }
+
+    os << "EventCache::Print - cached " << GetNEvent() << " event(s) in " << fSegments.size() << " segment(s): "
+       << GetMemBytes()/1048576.0 << " MB in memory, " << nspill << " segment(s) spilled to " << fSpillDir
+       << (fFailed ? " - INCOMPLETE" : "") << std::endl;
+  }
+
+  //==============================================================================
+  inline void EventCache::Clear()
+  {
+    Close();
+
+    for(Segment &seg: fSegments) {
+      if(seg.file) {
+	seg.file->Close();
+	delete seg.file;
+      }
+
+      if(!seg.spill_path.empty()) {
+	std::remove(seg.spill_path.c_str());
+      }
+    }
+
+    fSegments.clear();
+    fFailed = false;
+  }
+}
+
+#endif
@@ -0,0 +1,564 @@
+// -*- c++ -*-
+#ifndef ANP_FILESTAGE_H
+#define ANP_FILESTAGE_H
+
+/**********************************************************************************
+ * @Package: PhysicsAnpBase
+ * @Class  : FileStage
+ * @Author : Rustem Ospanov
+ *
+ * @Brief  : Stage input files from shared file system into local cache directory
+ *
+ *  Registry properties:
+ *    - StageDir      - local cache directory: empty disables staging
+ *    - StageMB       - cache size limit in MB: least recently used files are evicted
+ *    - StagePrefixes - stage only input paths with these prefixes (default: /lustre/)
+ *    - StagePrefetch - copy next input file in background thread
+ *
+ *  Stage() returns path of local copy: file is copied if cache has no valid copy.
+ *  Original path is returned if file can not be staged - job then reads source.
+ *
+ *  Integrity: each copy has sidecar <copy>.meta with source size and mtime.
+ *  Copy is valid only if sidecar matches current source size and mtime and local
+ *  size matches source size. Copies are written to <copy>.part (O_EXCL: only one
+ *  job copies a file) and renamed after size is checked, then sidecar is written.
+ *  Claimed .part file is extended to source size before data is copied, so that
+ *  copies in progress of all jobs count towards StageMB with their final size.
+ *
+ *  LRU: sidecar mtime is last use time, updated on each cache hit. Evict() is
+ *  called after .part file is claimed and removes least recently used copies until
+ *  copies and .part files fit in StageMB. Copy which is read now is never evicted.
+ *
+ *  Copy uses only POSIX I/O: prefetch thread never calls ROOT.
+ *
+ **********************************************************************************/
+
+// C/C++
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// POSIX
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utime.h>
+
+// Base
+#include "PhysicsAnpBase/Registry.h"
+#include "PhysicsAnpBase/Thread.h"
+
+namespace Anp
+{
+  class FileStage
+  {
+  public:
+
+    FileStage();
+    ~FileStage();
+
+    void Config(const Registry &reg);
+
+    bool IsEnabled() const { return !fStageDir.empty(); }
+
+    bool IsStageable(const std::string &path) const;
+
+    std::string Stage(const std::string &path);
+
+    void Prefetch(const std::string &path);
+
+    void Invalidate(const std::string &path);
+
+    void Print(std::ostream &os = std::cout) const;
+
+  private:
+
+    struct Copy
+    {
+      Copy() :size(0), used(0) {}
+
+      bool operator<(const Copy &rhs) const { return used < rhs.used; }
+
+      std::string  local;
+      long long    size;
+      time_t       used;
+    };
+
+  private:
+
+    std::string GetLocalPath(const std::string &path) const;
+
+    bool IsValidCopy(const std::string &path, const struct stat &src) const;
+
+    bool CopyFile(const std::string &path);
+
+    void Evict();
+
+    void WaitPrefetch();
+
+    static void* DoPrefetch(void *arg);
+
+  private:
+
+    FileStage(const FileStage &);
+    FileStage& operator=(const FileStage &);
+
+  private:
+
+    // Properties:
+    bool                      fDebug;
+    bool                      fPrefetch;       // Copy next file in background thread
+    std::string               fStageDir;       // Local cache directory
+    long long                 fStageBytes;     // Cache size limit: 0 - no limit
+    std::vector<std::string>  fPrefixes;       // Stage only paths with these prefixes
+
+    // Variables:
+    Thread                   *fThread;         // Prefetch thread
+    std::string               fPrefetchPath;   // Source path copied by prefetch thread
+    std::string               fCurrent;        // Local copy which is read now: never evicted
+
+    mutable Mutex             fMutex;          // Protects fCurrent and counters
+    unsigned                  fNHit;
+    unsigned                  fNCopy;
+    unsigned                  fNFail;
+    unsigned                  fNEvict;
+    double                    fBytesCopied;
+  };
+
+  //==============================================================================
+  // Inlined functions
+  //==============================================================================
+  inline FileStage::FileStage()
+    :fDebug      (false),
+     fPrefetch   (true),
+     fStageBytes (0),
+     fThread     (0),
+     fNHit       (0),
+     fNCopy      (0),
+     fNFail      (0),
+     fNEvict     (0),
+     fBytesCopied(0.0)
+  {
+  }
+
+  //==============================================================================
+  inline FileStage::~FileStage()
+  {
+    WaitPrefetch();
+  }
+
+  //==============================================================================
+  inline void FileStage::Config(const Registry &reg)
+  {
+    double stage_mb = 0.0;
+
+    reg.Get("Debug",         fDebug);
+    reg.Get("StageDir",      fStageDir);
+    reg.Get("StageMB",       stage_mb);
+    reg.Get("StagePrefetch", fPrefetch);
+
+    if(!reg.Get("StagePrefixes", fPrefixes)) {
+      fPrefixes.push_back("/lustre/");
+    }
+
+    fStageBytes = static_cast<long long>(stage_mb*1048576.0);
+
+    if(IsEnabled() && mkdir(fStageDir.c_str(), 0755) != 0 && errno != EEXIST) {
+      std::cerr << "FileStage::Config - can not create " << fStageDir << ": " << strerror(errno) << std::endl;
+      fStageDir.clear();
+    }
+  }
+
+  //==============================================================================
+  inline bool FileStage::IsStageable(const std::string &path) const
+  {
+    if(!IsEnabled()) {
+      return false;
+    }
+
+    for(const std::string &prefix: fPrefixes) {
+      if(path.compare(0, prefix.size(), prefix) == 0) {
+	return true;
+      }
+    }
+
+    return false;
+  }
+
+  //==============================================================================
+  inline std::string FileStage::Stage(const std::string &path)
+  {
+    if(!IsStageable(path)) {
+      return path;
+    }
+
+    if(path == fPrefetchPath) {
+      WaitPrefetch();
+    }
+
+    const std::string local = GetLocalPath(path);
+
+    struct stat src;
+
+    if(stat(path.c_str(), &src) != 0) {
+      return path;
+    }
+
+    if(IsValidCopy(path, src)) {
+      //
+      // Cache hit: update last use time
+      //
+      utime((local + ".meta").c_str(), 0);
+
+      Lock<Mutex> lock(fMutex);
+      fNHit++;
+      fCurrent = local;
+
+      return local;
+    }
+
+    if(CopyFile(path)) {
+      Lock<Mutex> lock(fMutex);
+      fCurrent = local;
+
+      return local;
+    }
+
+    //
+    // Source is read: previous copy is no longer protected from eviction
+    //
+    Lock<Mutex> lock(fMutex);
+    fCurrent.clear();
+
+    return path;
+  }
+
+  //==============================================================================
+  inline void FileStage::Prefetch(const std::string &path)
+  {
+    if(!fPrefetch || !IsStageable(path)) {
+      return;
+    }
+
+    WaitPrefetch();
+
+    struct stat src;
+
+    if(stat(path.c_str(), &src) != 0 || IsValidCopy(path, src)) {
+      return;
+    }
+
+    fPrefetchPath = path;
+    fThread       = new Thread(DoPrefetch, this);
+
+    if(fDebug) {
+      std::cout << "FileStage::Prefetch - " << path << std::endl;
+    }
+  }
+
+  //==============================================================================
+  inline void FileStage::Invalidate(const std::string &path)
+  {
+    //
+    // Called if local copy can not be opened: next Stage() copies file again
+    //
+    const std::string local = GetLocalPath(path);
+
+    std::remove((local + ".meta").c_str());
+    std::remove(local.c_str());
+  }
+
+  //==============================================================================
+  inline void FileStage::WaitPrefetch()
+  {
+    if(fThread) {
+      fThread->Join();
+      delete fThread;
+    }
+
+    fThread = 0;
+    fPrefetchPath.clear();
+  }
+
+  //==============================================================================
+  inline void* FileStage::DoPrefetch(void *arg)
+  {
+    FileStage *stage = static_cast<FileStage *>(arg);
+
+    stage->CopyFile(stage->fPrefetchPath);
+
+    return 0;
+  }
+
+  //==============================================================================
+  inline std::string FileStage::GetLocalPath(const std::string &path) const
+  {
+    //
+    // FNV-1a hash of full source path keeps files with same name apart
+    //
+    unsigned long long hash = 14695981039346656037ull;
+
+    for(const char c: path) {
+      hash = (hash ^ static_cast<unsigned char>(c))*1099511628211ull;
+    }
+
+    const std::string::size_type ipos = path.rfind('/');
+
+    std::stringstream str;
+    str << fStageDir << "/" << std::hex << std::setw(16) << std::setfill('0') << hash << "_"
+	<< (ipos == std::string::npos ? path : path.substr(ipos+1));
+
+    return str.str();
+  }
+
+  //==============================================================================
+  inline bool FileStage::IsValidCopy(const std::string &path, const struct stat &src) const
+  {
+    const std::string local = GetLocalPath(path);
+
+    struct stat dst;
+
+    if(stat(local.c_str(), &dst) != 0 || dst.st_size != src.st_size) {
+      return false;
+    }
+
+    std::ifstream meta((local + ".meta").c_str());
+
+    long long   size  = -1;
+    long long   mtime = -1;
+    std::string source;
+
+    if(!(meta >> size >> mtime) || !std::getline(meta >> std::ws, source)) {
+      return false;
+    }
+
+    return size == src.st_size && mtime == src.st_mtime && source == path;
+  }
+
+  //==============================================================================
+  inline bool FileStage::CopyFile(const std::string &path)
+  {
+    const std::string local = GetLocalPath(path);
+    const std::string part  = local + ".part";
+    const std::string meta  = local + ".meta";
+
+    struct stat src;
+
+    if(stat(path.c_str(), &src) != 0) {
+      return false;
+    }
+
+    const int ifd = open(path.c_str(), O_RDONLY);
+
+    if(ifd < 0) {
+      std::cerr << "FileStage::CopyFile - can not read " << path << ": " << strerror(errno) << std::endl;
+      return false;
+    }
+
+    //
+    // O_EXCL: file which is copied by another job is read from source
+    //
+    int ofd = open(part.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+
+    struct stat pst;
+
+    if(ofd < 0 && errno == EEXIST && stat(part.c_str(), &pst) == 0 && time(0) - pst.st_mtime > 600) {
+      //
+      // Partial copy left by killed job: not written to for 10 minutes
+      //
+      std::remove(part.c_str());
+      ofd = open(part.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+    }
+
+    if(ofd < 0) {
+      close(ifd);
+
+      Lock<Mutex> lock(fMutex);
+      fNFail++;
+
+      return false;
+    }
+
+    //
+    // Reserve final size: Evict() of this and other jobs counts it
+    //
+    if(ftruncate(ofd, src.st_size) != 0) {
+      std::cerr << "FileStage::CopyFile - can not extend " << part << ": " << strerror(errno) << std::endl;
+    }
+
+    Evict();
+
+    std::remove(meta.c_str());
+
+    std::vector<char> buf(4*1048576);
+    long long         ncopy = 0;
+    bool              ok    = true;
+
+    while(ok) {
+      const ssize_t nread = read(ifd, &buf.front(), buf.size());
+
+      if(nread == 0) {
+	break;
+      }
+
+      if(nread < 0) {
+	ok = (errno == EINTR);
+	continue;
+      }
+
+      for(ssize_t nout = 0; ok && nout < nread; ) {
+	const ssize_t nwrite = write(ofd, &buf.front() + nout, nread - nout);
+
+	if(nwrite < 0 && errno != EINTR) {
+	  ok = false;
+	}
+	else if(nwrite > 0) {
+	  nout += nwrite;
+	}
+      }
+
+      ncopy += nread;
+    }
+
+    close(ifd);
+
+    if(close(ofd) != 0 || ncopy != src.st_size) {
+      ok = false;
+    }
+
+    if(!ok || std::rename(part.c_str(), local.c_str()) != 0) {
+      std::cerr << "FileStage::CopyFile - failed to copy " << path << ": " << ncopy << " of " << src.st_size << " bytes" << std::endl;
+      std::remove(part.c_str());
+
+      Lock<Mutex> lock(fMutex);
+      fNFail++;
+
+      return false;
+    }
+
+    //
+    // Sidecar is written last: copy without sidecar is never used
+    //
+    {
+      std::ofstream outf((meta + ".part").c_str());
+      outf << static_cast<long long>(src.st_size) << " " << static_cast<long long>(src.st_mtime) << " " << path << std::endl;
+    }
+
+    std::rename((meta + ".part").c_str(), meta.c_str());
+
+    Lock<Mutex> lock(fMutex);
+    fNCopy++;
+    fBytesCopied += ncopy;
+
+    if(fDebug) {
+      std::cout << "FileStage::CopyFile - " << path << " -> " << local << std::endl;
+    }
+
+    return true;
+  }
+
+  //==============================================================================
+  inline void FileStage::Evict()
+  {
+    if(fStageBytes <= 0) {
+      return;
+    }
+
+    DIR *dir = opendir(fStageDir.c_str());
+
+    if(!dir) {
+      return;
+    }
+
+    std::vector<Copy> copies;
+    long long         total = 0;
+
+    while(dirent *entry = readdir(dir)) {
+      const std::string name = entry->d_name;
+
+      if(name.size() > 5 && name.compare(name.size()-5, 5, ".part") == 0) {
+	//
+	// Copies in progress are not evicted but use space
+	//
+	struct stat pst;
+
+	if(stat((fStageDir + "/" + name).c_str(), &pst) == 0) {
+	  total += pst.st_size;
+	}
+
+	continue;
+      }
+
+      if(name.size() < 6 || name.compare(name.size()-5, 5, ".meta") != 0) {
+	continue;
+      }
+
+      Copy copy;
+      copy.local = fStageDir + "/" + name.substr(0, name.size()-5);
+
+      struct stat mst, dst;
+
+      if(stat((fStageDir + "/" + name).c_str(), &mst) != 0 || stat(copy.local.c_str(), &dst) != 0) {
+	continue;
+      }
+
+      copy.size = dst.st_size;
+      copy.used = mst.st_mtime;
+      total    += copy.size;
+
+      copies.push_back(copy);
+    }
+
+    closedir(dir);
+
+    std::sort(copies.begin(), copies.end());
+
+    std::string current;
+    {
+      Lock<Mutex> lock(fMutex);
+      current = fCurrent;
+    }
+
+    for(const Copy &copy: copies) {
+      if(total <= fStageBytes) {
+	break;
+      }
+
+      if(copy.local == current) {
+	continue;
+      }
+
+      std::remove((copy.local + ".meta").c_str());
+      std::remove(copy.local.c_str());
+
+      total -= copy.size;
+
+      Lock<Mutex> lock(fMutex);
+      fNEvict++;
+    }
+  }
+
+  //==============================================================================
+  inline void FileStage::Print(std::ostream &os) const
+  {
+    if(!IsEnabled()) {
+      return;
+    }
+
+    Lock<Mutex> lock(fMutex);
+
+    os << "FileStage::Print - " << fStageDir << ": " << fNHit << " hit(s), " << fNCopy << " copied file(s) with "
+       << fBytesCopied/1048576.0 << " MB, " << fNFail << " failed, " << fNEvict << " evicted" << std::endl;
+  }
+}
+
+#endif
@@ -7,7 +7,9 @@
 #include "PhysicsAnpBase/HistMan.h"
 #include "PhysicsAnpBase/Registry.h"
 #include "PhysicsAnpBase/ReadNtuple.h"
+#include "PhysicsAnpBase/ReadProcs.h"
 #include "PhysicsAnpBase/RunModule.h"
+#include "PhysicsAnpBase/RunWatch.h"
 #include "PhysicsAnpBase/UtilBase.h"
 
 #ifdef __GCCXML__
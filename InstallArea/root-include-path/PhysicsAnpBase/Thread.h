@@ -102,6 +102,8 @@ namespace Anp
     Mutex&   GetMutex() { return fMutex; }
     
     int GetStatus() const { return fStatus; }
+
+    int Join();
     
   private:
     
@@ -205,6 +207,21 @@ namespace Anp
       std::cerr << "Thread ctor - failed to create pthread" << std::endl;
     }
   }
+
+  inline int Thread::Join() {
+    if(fStatus != 0) {
+      return fStatus;
+    }
+
+    const int status_join = pthread_join(fThread, NULL);
+    if(status_join != 0) {
+      std::cerr << "pthread_join() failed" << std::endl;
+    }
+    else {
+      fStatus = -1;
+    }
+    return status_join;
+  }
 }
 
 #endif
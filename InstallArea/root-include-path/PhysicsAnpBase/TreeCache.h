@@ -0,0 +1,228 @@
+// -*- c++ -*-
+#ifndef ANP_TREECACHE_H
+#define ANP_TREECACHE_H
+
+/**********************************************************************************
+ * @Package: PhysicsAnpBase
+ * @Class  : TreeCache
+ * @Author : Rustem Ospanov
+ *
+ * @Brief  : Configure TTreeCache for input trees and collect read statistics
+ *
+ *  Registry properties:
+ *    - CacheSize         - TTreeCache size in bytes: 0 disables cache
+ *    - CacheLearnEntries - number of entries for learning phase
+ *    - CachePrefetch     - enable asynchronous prefetching of next cluster
+ *    - CacheUnzip        - decompress cached baskets in ROOT unzip thread (TTreeCacheUnzip)
+ *
+ *  Cache is filled only with branches that are active when Attach() is called,
+ *  so Attach() must be called after branch statuses are set.
+ *
+ *  Prefetch() must be called before input file is opened because
+ *  TFile reads TFile.AsyncPrefetching setting when file is created:
+ *  RestorePrefetch() puts back previous gEnv value once file is open,
+ *  so that files opened by other code are not affected.
+ *
+ *  CacheUnzip is the only read-ahead available to the prebuilt event loops: objects
+ *  are still filled by main thread, ROOT thread only unzips baskets of the cache.
+ *  TTreeCacheUnzip is selected when the cache is created, so Attach() enables
+ *  parallel unzip only while calling TTree::SetCacheSize().
+ *
+ **********************************************************************************/
+
+// C/C++
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+// ROOT
+#include "TBranch.h"
+#include "TEnv.h"
+#include "TFile.h"
+#include "TTree.h"
+#include "TTreeCache.h"
+#include "TTreeCacheUnzip.h"
+
+// Base
+#include "PhysicsAnpBase/Registry.h"
+
+namespace Anp
+{
+  class TreeCache
+  {
+  public:
+
+    TreeCache();
+    ~TreeCache() {}
+
+    void Config(const Registry &reg);
+
+    void Prefetch();
+
+    void RestorePrefetch();
+
+    void Attach(TTree *tree);
+
+    void Detach(TTree *tree, TFile *file);
+
+    void Print(std::ostream &os = std::cout) const;
+
+    bool IsEnabled() const { return fCacheSize > 0; }
+
+  private:
+
+    // Properties:
+    bool       fDebug;            // Print debug info
+    bool       fPrefetch;         // Asynchronous prefetching of next cluster
+    bool       fUnzip;            // Unzip cached baskets in ROOT thread
+    long       fCacheSize;        // TTreeCache size in bytes
+    int        fLearnEntries;     // Number of entries for learning phase
+
+    // Variables:
+    bool       fPrefetchSet;      // TFile.AsyncPrefetching is set by Prefetch()
+    int        fPrevPrefetch;     // TFile.AsyncPrefetching value before Prefetch()
+    unsigned   fNFile;            // Number of detached files
+    unsigned   fNBranch;          // Number of branches added to cache for last tree
+    long       fNReadCalls;       // Total number of read calls
+    double     fBytesRead;        // Total number of bytes read
+    double     fSumEff;           // Sum of cache efficiencies
+    double     fSumEffRel;        // Sum of relative cache efficiencies
+  };
+
+  //==============================================================================
+  // Inlined functions
+  //==============================================================================
+  inline TreeCache::TreeCache()
+    :fDebug       (false),
+     fPrefetch    (false),
+     fUnzip       (false),
+     fCacheSize   (30*1024*1024),
+     fLearnEntries(100),
+     fPrefetchSet (false),
+     fPrevPrefetch(0),
+     fNFile       (0),
+     fNBranch     (0),
+     fNReadCalls  (0),
+     fBytesRead   (0.0),
+     fSumEff      (0.0),
+     fSumEffRel   (0.0)
+  {
+  }
+
+  //==============================================================================
+  inline void TreeCache::Config(const Registry &reg)
+  {
+    reg.Get("Debug",             fDebug);
+    reg.Get("CacheSize",         fCacheSize);
+    reg.Get("CacheLearnEntries", fLearnEntries);
+    reg.Get("CachePrefetch",     fPrefetch);
+    reg.Get("CacheUnzip",        fUnzip);
+  }
+
+  //==============================================================================
+  inline void TreeCache::Prefetch()
+  {
+    if(IsEnabled() && fPrefetch && gEnv && !fPrefetchSet) {
+      fPrevPrefetch = gEnv->GetValue("TFile.AsyncPrefetching", 0);
+      fPrefetchSet  = true;
+
+      gEnv->SetValue("TFile.AsyncPrefetching", 1);
+    }
+  }
+
+  //==============================================================================
+  inline void TreeCache::RestorePrefetch()
+  {
+    if(fPrefetchSet && gEnv) {
+      gEnv->SetValue("TFile.AsyncPrefetching", fPrevPrefetch);
+    }
+
+    fPrefetchSet = false;
+  }
+
+  //==============================================================================
+  inline void TreeCache::Attach(TTree *tree)
+  {
+    fNBranch = 0;
+
+    if(!tree || !IsEnabled()) {
+      return;
+    }
+
+    const bool prev_unzip = TTreeCacheUnzip::IsParallelUnzip();
+
+    if(fUnzip) {
+      TTreeCacheUnzip::SetParallelUnzip(TTreeCacheUnzip::kEnable);
+    }
+
+    tree->SetCacheSize(fCacheSize);
+    tree->SetCacheLearnEntries(fLearnEntries);
+
+    if(fUnzip && !prev_unzip) {
+      TTreeCacheUnzip::SetParallelUnzip(TTreeCacheUnzip::kDisable);
+    }
+
+    //
+    // Seed cache with active branches: disabled branches are never learned
+    //
+    TObjArray *branches = tree->GetListOfBranches();
+
+    for(int i = 0; branches && i < branches->GetEntries(); ++i) {
+      TBranch *branch = dynamic_cast<TBranch *>(branches->At(i));
+
+      if(branch && tree->GetBranchStatus(branch->GetName())) {
+	tree->AddBranchToCache(branch, true);
+	++fNBranch;
+      }
+    }
+
+    if(fDebug) {
+      std::cout << "TreeCache::Attach - " << tree->GetName() << ": size=" << fCacheSize
+		<< " learn=" << fLearnEntries << " unzip=" << fUnzip << " active branches=" << fNBranch << std::endl;
+    }
+  }
+
+  //==============================================================================
+  inline void TreeCache::Detach(TTree *tree, TFile *file)
+  {
+    //
+    // Collect read statistics before input file is closed
+    //
+    if(!file) {
+      return;
+    }
+
+    ++fNFile;
+    fNReadCalls += file->GetReadCalls();
+    fBytesRead  += file->GetBytesRead();
+
+    TTreeCache *cache = file->GetCacheRead(tree);
+
+    if(cache) {
+      fSumEff    += cache->GetEfficiency();
+      fSumEffRel += cache->GetEfficiencyRel();
+    }
+  }
+
+  //==============================================================================
+  inline void TreeCache::Print(std::ostream &os) const
+  {
+    if(fNFile == 0) {
+      return;
+    }
+
+    const std::streamsize prec = os.precision();
+
+    os << "TreeCache::Print - " << fNFile << " file(s) read with cache size " << fCacheSize
+       << (fPrefetch ? " and async prefetch" : "") << (fUnzip ? " and unzip thread" : "") << std::endl
+       << "   read calls:          " << fNReadCalls << std::endl
+       << "   MB read:             " << std::fixed << std::setprecision(1) << fBytesRead/1048576.0 << std::endl
+       << "   mean efficiency:     " << std::setprecision(3) << fSumEff/fNFile << std::endl
+       << "   mean efficiency rel: " << fSumEffRel/fNFile << std::endl;
+
+    os.unsetf(std::ios_base::floatfield);
+    os.precision(prec);
+  }
+}
+
+#endif
@@ -11,13 +11,26 @@
  *  
  * One floating variable with unsigned integer key
  *
+ * Value is stored in double, Long64_t or ULong64_t field selected by status.
+ * GetAs<T>() is type-checked read from field of stored value: returns false if
+ * integer T can not hold value exactly (out of range or fractional double),
+ * floating T accepts any stored value.
+ *
+ * Layout (key, status and three value fields, 32 bytes) is kept: VarEntry is
+ * stored by value in VarHolder and its size and field offsets are compiled into
+ * libPhysicsAnpData and algorithm libraries, so that smaller tagged union needs
+ * all of them to be rebuilt together with this header.
+ *
  **********************************************************************************/
 
 // ROOT
 #include "RtypesCore.h"
 
 // C/C++
+#include <cmath>
+#include <limits>
 #include <stdint.h>
+#include <type_traits>
 
 namespace Anp
 {
@@ -43,6 +56,15 @@ namespace Anp
     bool IsValidL64   () const { return fStatus == 2; }
     bool IsValidU64   () const { return fStatus == 3; }
 
+    template<class T> bool GetAs(T &value) const;
+
+  private:
+
+    template<class T> static bool Convert(double    value, T &out, std::true_type);
+    template<class T> static bool Convert(Long64_t  value, T &out, std::true_type);
+    template<class T> static bool Convert(ULong64_t value, T &out, std::true_type);
+    template<class S, class T> static bool Convert(S value, T &out, std::false_type);
+
   private:
     
     uint32_t  fKey;      // variable key
@@ -52,6 +74,72 @@ namespace Anp
     Long64_t  fDataL64;  // variable value: 64 bit unsigned integer
     ULong64_t fDataU64;  // variable value: 64 bit unsigned integer
   };
+
+  //
+  // Inlined member functions
+  //
+  template<class T> inline bool VarEntry::GetAs(T &value) const
+  {
+    switch(fStatus) {
+    case 1:  return Convert(fDataD,   value, std::is_integral<T>());
+    case 2:  return Convert(fDataL64, value, std::is_integral<T>());
+    case 3:  return Convert(fDataU64, value, std::is_integral<T>());
+    default: return false;
+    }
+  }
+
+  //
+  // Integer output: value must be whole number inside range of T
+  //
+  template<class T> inline bool VarEntry::Convert(double value, T &out, std::true_type)
+  {
+    //
+    // Range of T is [min, 2^digits): both limits are exact doubles
+    //
+    const double vmax = std::ldexp(1.0, std::numeric_limits<T>::digits);
+    const double vmin = static_cast<double>(std::numeric_limits<T>::min());
+
+    if(!(value >= vmin && value < vmax) || std::trunc(value) != value) {
+      return false;
+    }
+
+    out = static_cast<T>(value);
+    return true;
+  }
+
+  template<class T> inline bool VarEntry::Convert(Long64_t value, T &out, std::true_type)
+  {
+    if(value < 0) {
+      if(!std::numeric_limits<T>::is_signed || value < static_cast<Long64_t>(std::numeric_limits<T>::min())) {
+	return false;
+      }
+    }
+    else if(static_cast<ULong64_t>(value) > static_cast<ULong64_t>(std::numeric_limits<T>::max())) {
+      return false;
+    }
+
+    out = static_cast<T>(value);
+    return true;
+  }
+
+  template<class T> inline bool VarEntry::Convert(ULong64_t value, T &out, std::true_type)
+  {
+    if(value > static_cast<ULong64_t>(std::numeric_limits<T>::max())) {
+      return false;
+    }
+
+    out = static_cast<T>(value);
+    return true;
+  }
+
+  //
+  // Floating output: any stored value
+  //
+  template<class S, class T> inline bool VarEntry::Convert(S value, T &out, std::false_type)
+  {
+    out = static_cast<T>(value);
+    return true;
+  }
   
   //
   // Inlined comparison operators
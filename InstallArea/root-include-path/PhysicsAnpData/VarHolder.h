@@ -10,6 +10,16 @@
  * @Brief  :
  * 
  *  VarHolder is candidate analysis object created by algorithms
+ *
+ *  GetVarAs<T>() reads variable with VarEntry::GetAs(): fails if integer T can not
+ *  hold stored value exactly.
+ *
+ *  Variables are found with FindVar(): position of each key in last holder where
+ *  it was found is kept in per-thread hint table. Objects of one type are filled
+ *  by same algorithm in same order, so that hint is usually exact and lookup does
+ *  not scan fVars. Hint is verified against key stored at hinted position: result
+ *  does not depend on hints. Insertion still checks all keys of holder: class
+ *  layout is fixed by compiled libraries, so holder keeps no index of its own.
  *  
  **********************************************************************************/
 
@@ -17,6 +27,7 @@
 #include <algorithm>
 #include <iostream>
 #include <set>
+#include <stdint.h>
 #include <vector> 
 
 // Local
@@ -97,6 +108,8 @@ namespace Anp
     bool GetVarU64(unsigned key, ULong64_t &value) const;
     bool GetVarU64(unsigned key, uint64_t  &value) const;
 
+    template<class T> bool GetVarAs(unsigned key, T &value) const;
+
     bool GetVarVec   (unsigned key, std::vector<int>       &value) const;
     bool GetVarVec   (unsigned key, std::vector<float>     &value) const;
     bool GetVarVecL64(unsigned key, std::vector<Long64_t>  &value) const;
@@ -117,6 +130,12 @@ namespace Anp
     
     std::string GetVarsAsStr(const std::string &pad="") const;
 
+  private:
+
+    VarEntryVec::const_iterator FindVar(unsigned key) const;
+
+    static unsigned& GetPosHint(unsigned key);
+
   private:
 
     typedef std::vector<VecEntry<int> >       IntVec;
@@ -299,7 +318,7 @@ namespace Anp
   inline bool Anp::VarHolder::HasKey(unsigned key) const
   {
     return 
-      std::find(fVars   .begin(), fVars   .end(), key) != fVars   .end() ||
+      FindVar(key) != fVars.end() ||
       std::find(fInts   .begin(), fInts   .end(), key) != fInts   .end() ||
       std::find(fFloats .begin(), fFloats .end(), key) != fFloats .end() ||
       std::find(fVecL64 .begin(), fVecL64 .end(), key) != fVecL64 .end() ||
@@ -320,16 +339,45 @@ namespace Anp
   //===============================================================================================================
   inline bool Anp::VarHolder::HasVar(unsigned key) const
   {
-    return std::find(fVars.begin(), fVars.end(), key) != fVars.end();
+    return FindVar(key) != fVars.end();
   }
   
+  //===============================================================================================================
+  inline Anp::VarEntryVec::const_iterator Anp::VarHolder::FindVar(const unsigned key) const
+  {
+    unsigned &hint = GetPosHint(key);
+
+    if(hint < fVars.size() && fVars[hint].GetKey() == key) {
+      return fVars.begin() + hint;
+    }
+
+    const VarEntryVec::const_iterator ivar = std::find(fVars.begin(), fVars.end(), key);
+
+    if(ivar != fVars.end()) {
+      hint = ivar - fVars.begin();
+    }
+
+    return ivar;
+  }
+
+  //===============================================================================================================
+  inline unsigned& Anp::VarHolder::GetPosHint(const unsigned key)
+  {
+    //
+    // Direct-mapped table: keys with same low bits share hint
+    //
+    static thread_local unsigned hints[1024] = {};
+
+    return hints[key & 1023u];
+  }
+
   //===============================================================================================================
   inline bool Anp::VarHolder::GetVar(unsigned key, float &value) const
   {
     //
     // Read variable
     //
-    const VarEntryVec::const_iterator ivar = std::find(fVars.begin(), fVars.end(), key);
+    const VarEntryVec::const_iterator ivar = FindVar(key);
     if(ivar != fVars.end()) {
       value = ivar->GetValue();
       return true;
@@ -344,7 +392,7 @@ namespace Anp
     //
     // Read variable
     //
-    const VarEntryVec::const_iterator ivar = std::find(fVars.begin(), fVars.end(), key);
+    const VarEntryVec::const_iterator ivar = FindVar(key);
     if(ivar != fVars.end()) {
       value = ivar->GetValue();
       return true;
@@ -378,7 +426,7 @@ namespace Anp
   //===============================================================================================================
   inline bool Anp::VarHolder::GetVarL64(unsigned key, Long64_t &value) const
   {
-    const VarEntryVec::const_iterator vit = std::find(fVars.begin(), fVars.end(), key);
+    const VarEntryVec::const_iterator vit = FindVar(key);
 
     if(vit != fVars.end() && vit->IsValidL64()) {
       value = vit->GetValueL64();
@@ -391,7 +439,7 @@ namespace Anp
   //===============================================================================================================
   inline bool Anp::VarHolder::GetVarU64(unsigned key, ULong64_t &value) const
   {
-    const VarEntryVec::const_iterator vit = std::find(fVars.begin(), fVars.end(), key);
+    const VarEntryVec::const_iterator vit = FindVar(key);
 
     if(vit != fVars.end() && vit->IsValidU64()) {
       value = vit->GetValueU64();
@@ -480,6 +528,17 @@ namespace Anp
     return false;
   }
 
+  //===============================================================================================================
+  template<class T> inline bool Anp::VarHolder::GetVarAs(unsigned key, T &value) const
+  {
+    //
+    // Type-checked read from native lane of variable: see VarEntry::GetAs()
+    //
+    const VarEntryVec::const_iterator ivar = FindVar(key);
+
+    return ivar != fVars.end() && ivar->GetAs(value);
+  }
+
   //===============================================================================================================
   inline int Anp::VarHolder::GetInt(const unsigned key, const int defval) const
   {
@@ -91,6 +91,17 @@ namespace Rpc
     }
   }
   
+  template<> inline void ReadVar<Long64_t>(const Anp::VarHolder &h, Anp::Var::Def var, Long64_t &val)
+  {
+    //
+    // Type-checked read: missing variable is ignored, unsigned value above LLONG_MAX
+    // or fractional double is rejected
+    //
+    if(h.HasVar(var) && !h.GetVarAs(var, val)) {
+      std::cout << "Rpc::ReadVar - Long64_t with bad value: " << Anp::Var::AsStr(var) << " = " << h.GetDbl(var, 0.0) << std::endl; 
+    }
+  }
+
   template<> inline void ReadVar<ULong64_t>(const Anp::VarHolder &h, Anp::Var::Def var, ULong64_t &val)
   {
     if(!h.GetVarU64(var, val)) {
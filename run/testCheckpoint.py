@@ -0,0 +1,216 @@
+#!/usr/bin/env python
+
+'''
+Test checkpoint and resume (--checkpoint, --resume) of single process job:
+
+  - write input tree with flat event variables and L1 muon RoI list
+  - run job with PrepReco, PrepL1Muon and PlotL1Muon algorithms to the end
+  - run same job with checkpoint every 1000 entries, kill it with SIGKILL after
+    first checkpoint is written and resume it with --resume
+  - check that all histograms of resumed output are identical to straight output
+
+Algorithms of this job keep their state only in histograms: they are declared
+with --checkpoint-safe, otherwise ReadLoop refuses checkpoint.
+
+Usage: python testCheckpoint.py
+Exit status is 1 if any check fails.
+'''
+
+import os
+import sys
+import time
+import shutil
+import signal
+import subprocess
+import tempfile
+
+import PhysicsAnpBase.PhysicsAnpBaseConfig  as physicsBase
+import PhysicsAnpRPC .PhysicsAnpRPCConfig   as config
+import PhysicsAnpRPC .PhysicsAnpRPCPanelEff as panelEff
+import PhysicsAnpRPC .PhysicsAnpRPCTrigger  as trigger
+
+log = physicsBase.getLog(os.path.basename(__file__))
+
+safe_algs = 'RunAlgs,PrepReco,PrepL1Muon,PlotL1Muon'
+
+#========================================================================================================
+def writeInputTree(ROOT, path, nevent):
+
+    import array
+
+    ifile = ROOT.TFile(path, 'RECREATE')
+    itree = ROOT.TTree('nominal', 'nominal')
+
+    flat = {}
+    for name in ['Run', 'LumiBlock', 'EventNumber']:
+        flat[name] = array.array('i', [0])
+        itree.Branch(name, flat[name], '%s/I' %name)
+
+    vecs = {}
+    for name in ['m_l1mu_ctpi_source', 'm_l1mu_ctpi_thrNumber', 'm_l1mu_ctpi_hemisphere', 'm_l1mu_ctpi_bcid_rel',
+                 'm_l1mu_ctpi_eta', 'm_l1mu_ctpi_phi']:
+        vecs[name] = ROOT.std.vector('float')()
+        itree.Branch(name, vecs[name])
+
+    for i in range(nevent):
+        flat['Run'][0]         = 350121
+        flat['LumiBlock'][0]   = 1 + i/1000
+        flat['EventNumber'][0] = i
+
+        for vec in vecs.values():
+            vec.clear()
+
+        for j in range(i%4):
+            vecs['m_l1mu_ctpi_source'    ].push_back(j%2)
+            vecs['m_l1mu_ctpi_thrNumber' ].push_back(1 + (i+j)%6)
+            vecs['m_l1mu_ctpi_hemisphere'].push_back((i+j)%2)
+            vecs['m_l1mu_ctpi_bcid_rel'  ].push_back((i+j)%3 - 1)
+            vecs['m_l1mu_ctpi_eta'       ].push_back(-1.0 + 0.0001*((i*7+j)%20000))
+            vecs['m_l1mu_ctpi_phi'       ].push_back(-3.0 + 0.0001*((i*3+j)%60000))
+
+        itree.Fill()
+
+    ifile.Write()
+    ifile.Close()
+
+#========================================================================================================
+def runJob(input_file, output_file, checkpoint, resume):
+
+    sys.argv = [sys.argv[0], '-o', output_file]
+
+    if checkpoint:
+        sys.argv += ['--checkpoint', checkpoint, '--checkpoint-nevent', '1000', '--checkpoint-safe', safe_algs]
+    if resume:
+        sys.argv += ['--resume']
+
+    parser  = config.prepareOptionParser()
+    options = parser.parse_args()[0]
+
+    import ROOT
+    ROOT.gROOT.SetBatch(True)
+
+    config.loadPhysicsAnpRPCLibs(ROOT)
+
+    top_algs = [config.getPrepReco      ('prepReco',   options),
+                trigger.getPrepL1Muon   ('prepL1Muon', options),
+                trigger.getPlotL1MuonAlg('plotL1Muon', options)]
+
+    run = panelEff.prepareReadModule(ROOT, options, [input_file], top_algs)
+    run.ExecuteRegistry()
+
+    return 0
+
+#========================================================================================================
+def startJob(input_file, output_file, checkpoint, resume):
+
+    args = [sys.executable, os.path.abspath(__file__), 'run', input_file, output_file, checkpoint, str(resume)]
+
+    return subprocess.Popen(args)
+
+#========================================================================================================
+def readHists(ROOT, dir, prefix, hists):
+
+    for key in dir.GetListOfKeys():
+        obj = key.ReadObj()
+
+        if obj.InheritsFrom('TDirectory'):
+            readHists(ROOT, obj, prefix + obj.GetName() + '/', hists)
+        elif obj.InheritsFrom('TH1'):
+            hists[prefix + obj.GetName()] = [obj.GetEntries()] + [obj.GetBinContent(i) for i in range(obj.GetNcells())]
+
+#========================================================================================================
+def compareOutputs(ROOT, straight_file, resumed_file):
+
+    hists = []
+
+    for path in [straight_file, resumed_file]:
+        ifile = ROOT.TFile(path, 'READ')
+        hists += [{}]
+        readHists(ROOT, ifile, '', hists[-1])
+        ifile.Close()
+
+    straight, resumed = hists
+    nfail = 0
+
+    if len(straight) == 0:
+        log.error('compareOutputs - no histograms in: %s' %straight_file)
+        nfail += 1
+
+    for name in sorted(set(straight.keys()) | set(resumed.keys())):
+        if name not in straight or name not in resumed:
+            log.error('compareOutputs - %s: histogram is missing in one output' %name)
+            nfail += 1
+        elif straight[name] != resumed[name]:
+            log.error('compareOutputs - %s: entries %d != %d' %(name, straight[name][0], resumed[name][0]))
+            nfail += 1
+
+    log.info('compareOutputs - compared %d histogram(s)' %len(straight))
+    return nfail
+
+#========================================================================================================
+def main():
+
+    tmp_dir    = tempfile.mkdtemp(prefix='anp_test_checkpoint_')
+    tmp_file   = '%s/input.root'         %tmp_dir
+    straight   = '%s/out_straight.root'  %tmp_dir
+    resumed    = '%s/out_resumed.root'   %tmp_dir
+    checkpoint = '%s/checkpoint.root'    %tmp_dir
+
+    import ROOT
+    ROOT.gROOT.SetBatch(True)
+
+    writeInputTree(ROOT, tmp_file, 100000)
+
+    #
+    # Straight job
+    #
+    if startJob(tmp_file, straight, '', False).wait() != 0:
+        log.error('main - straight job failed')
+        return 1
+
+    #
+    # Killed job: SIGKILL as soon as first checkpoint exists
+    #
+    job = startJob(tmp_file, resumed, checkpoint, False)
+
+    while job.poll() == None and not os.path.exists(checkpoint):
+        time.sleep(0.01)
+
+    if job.poll() != None:
+        log.error('main - job finished before checkpoint was written: checkpoint refused or too few input events')
+        return 1
+
+    os.kill(job.pid, signal.SIGKILL)
+    job.wait()
+
+    log.info('main - killed job after checkpoint: %s' %checkpoint)
+
+    #
+    # Resumed job
+    #
+    if startJob(tmp_file, resumed, checkpoint, True).wait() != 0:
+        log.error('main - resumed job failed')
+        return 1
+
+    nfail = compareOutputs(ROOT, straight, resumed)
+
+    if os.path.exists(checkpoint):
+        log.error('main - checkpoint was not removed by finished job')
+        nfail += 1
+
+    shutil.rmtree(tmp_dir)
+
+    if nfail:
+        log.error('main - %d check(s) failed' %nfail)
+        return 1
+
+    log.info('main - all checks passed')
+    return 0
+
+#========================================================================================================
+if __name__ == '__main__':
+
+    if len(sys.argv) == 6 and sys.argv[1] == 'run':
+        sys.exit(runJob(sys.argv[2], sys.argv[3], sys.argv[4], sys.argv[5] == 'True'))
+
+    sys.exit(main())
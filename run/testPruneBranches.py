@@ -0,0 +1,148 @@
+#!/usr/bin/env python
+
+'''
+Test branch pruning (--prune-branches) with configuration of RPC panel efficiency job:
+
+  - write small input tree with Lists branches of panel efficiency job, one vector
+    branch outside Lists and flat event variables
+  - declare input branches with ReadLoop::DeclareUsage() from job configuration
+  - check that BranchUsage::PruneTree() disables m_rpc_rdo_ list, which is read only
+    with raw RPC channels, and vector branch outside Lists, and keeps other lists
+
+Usage: python testPruneBranches.py
+Exit status is 1 if any check fails.
+'''
+
+import os
+import sys
+import shutil
+import tempfile
+
+import PhysicsAnpBase.PhysicsAnpBaseConfig as physicsBase
+import PhysicsAnpRPC .PhysicsAnpRPCConfig  as config
+import PhysicsAnpRPC .PhysicsAnpRPCPanelEff as panelEff
+
+log = physicsBase.getLog(os.path.basename(__file__))
+
+#========================================================================================================
+def writeInputTree(ROOT, path):
+
+    import array
+
+    ifile = ROOT.TFile(path, 'RECREATE')
+    itree = ROOT.TTree('nominal', 'nominal')
+
+    flat = {}
+    for name in ['Run', 'LumiBlock', 'HLT_mu26_ivarmedium']:
+        flat[name] = array.array('i', [0])
+        itree.Branch(name, flat[name], '%s/I' %name)
+
+    vecs = {}
+    for name in ['m_muon_pt', 'm_rpc_hit_prdTime', 'm_l1mu_ctpi_source', 'm_rpc_rdo_channel', 'm_trk_pt']:
+        vecs[name] = ROOT.std.vector('float')()
+        itree.Branch(name, vecs[name])
+
+    for i in range(100):
+        flat['Run'][0]       = 350121
+        flat['LumiBlock'][0] = 1 + i/10
+        flat['HLT_mu26_ivarmedium'][0] = i%2
+
+        for vec in vecs.values():
+            vec.clear()
+            for j in range(i%5):
+                vec.push_back(1.0*j)
+
+        itree.Fill()
+
+    ifile.Write()
+    ifile.Close()
+
+#========================================================================================================
+def checkBranches(ROOT, path, expected):
+
+    usage = physicsBase.getAnpClass('BranchUsage').Instance()
+
+    ifile = ROOT.TFile(path, 'READ')
+    itree = ifile.Get('nominal')
+
+    usage.PruneTree(itree)
+
+    nfail = 0
+
+    for branch, status in expected:
+        if bool(itree.GetBranchStatus(branch)) != status:
+            log.error('checkBranches - %s: status=%d, expected %d' %(branch, itree.GetBranchStatus(branch), status))
+            nfail += 1
+
+    ifile.Close()
+    return nfail
+
+#========================================================================================================
+def main():
+
+    tmp_dir  = tempfile.mkdtemp(prefix='anp_test_prune_')
+    tmp_file = '%s/input.root' %tmp_dir
+    geo_file = '%s/rpc_geometry.root' %tmp_dir
+
+    #
+    # Geometry file is only required to exist: it is not read before Init()
+    #
+    open(geo_file, 'w').close()
+
+    sys.argv = [sys.argv[0], '--prune-branches', '--rpc-geo', geo_file, '-o', '%s/out.root' %tmp_dir]
+
+    parser  = config.prepareOptionParser()
+    options = parser.parse_args()[0]
+
+    import ROOT
+    ROOT.gROOT.SetBatch(True)
+
+    config.loadPhysicsAnpRPCLibs(ROOT)
+
+    writeInputTree(ROOT, tmp_file)
+
+    run = panelEff.prepareJobConfig(ROOT, options, [tmp_file])
+
+    read_loop = physicsBase.getAnpClass('ReadLoop')
+    usage     = physicsBase.getAnpClass('BranchUsage').Instance()
+
+    #
+    # Default: flat event variables are kept
+    #
+    read_loop.DeclareUsage(run.GetRegistryConfig())
+    usage.Print()
+
+    nfail = checkBranches(ROOT, tmp_file, [('m_muon_pt',           True),
+                                           ('m_rpc_hit_prdTime',   True),
+                                           ('m_l1mu_ctpi_source',  True),
+                                           ('m_rpc_rdo_channel',   False),
+                                           ('m_trk_pt',            False),
+                                           ('Run',                 True),
+                                           ('LumiBlock',           True),
+                                           ('HLT_mu26_ivarmedium', True)])
+
+    #
+    # PruneScalars=yes: only declared flat variables and run/lumi block are kept
+    #
+    usage.Clear()
+    run.SetKey('PruneScalars', True)
+    read_loop.DeclareUsage(run.GetRegistryConfig())
+
+    nfail += checkBranches(ROOT, tmp_file, [('m_muon_pt',           True),
+                                            ('m_rpc_rdo_channel',   False),
+                                            ('Run',                 True),
+                                            ('LumiBlock',           True),
+                                            ('HLT_mu26_ivarmedium', False)])
+
+    shutil.rmtree(tmp_dir)
+
+    if nfail:
+        log.error('main - %d check(s) failed' %nfail)
+        return 1
+
+    log.info('main - all checks passed')
+    return 0
+
+#========================================================================================================
+if __name__ == '__main__':
+    sys.exit(main())